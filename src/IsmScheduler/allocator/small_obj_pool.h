@@ -1,59 +1,131 @@
-
+#pragma once
+#include <cassert>
 #include <cstddef>
 #include <cstdint>
+#include <cstdlib>
 #include <atomic>
-#include "../schedule.h"
+#include <new>
+#include <utility>
 
+// Per-worker pool of fixed size blocks for task proxies and other small
+// scheduler objects.
+//
+// Blocks are carved out of slabs aligned to their own size, so the pool
+// that owns a block is found by masking its address. The owner allocates
+// and frees through a private free list without any atomics. A worker
+// freeing a block it does not own pushes it onto the owner's remote
+// list, which the owner takes over with a single exchange once its
+// private list runs dry.
+//
+// Slabs are only released when the pool is destroyed, which has to
+// happen after every worker that could free into it has stopped.
 class small_object_pool {
-protected:
-    small_object_pool() = default;
-};
+ public:
+  static constexpr std::size_t block_size = 64;
+  static constexpr std::size_t slab_size = 64 * 1024;
 
+  small_object_pool() = default;
+  small_object_pool(const small_object_pool&) = delete;
+  small_object_pool& operator=(const small_object_pool&) = delete;
 
-class small_object_allocator {
-public:
-    template <typename Type, typename... Args>
-    Type* new_object(workerInfo& ed, Args&&... args) {
-        void* allocated_object = allocate(m_pool, sizeof(Type), ed);
-        auto constructed_object = new(allocated_object) Type(std::forward<Args>(args)...);
-        return constructed_object;
+  ~small_object_pool() {
+    while (slabs) {
+      slab_header* next = slabs->next;
+      std::free(slabs);
+      slabs = next;
     }
+  }
 
-    template <typename Type, typename... Args>
-    Type* new_object(Args&&... args) {
-        void* allocated_object = allocate(m_pool, sizeof(Type));
-        auto constructed_object = new(allocated_object) Type(std::forward<Args>(args)...);
-        return constructed_object;
-    }
+  template <typename Type, typename... Args>
+  Type* new_object(Args&&... args) {
+    static_assert(sizeof(Type) <= block_size, "object does not fit in a pool block");
+    static_assert(alignof(Type) <= block_size, "object is over-aligned for a pool block");
+    return new (allocate()) Type(std::forward<Args>(args)...);
+  }
 
-    template <typename Type>
-    void delete_object(Type* object, const workerInfo& ed) {
-        small_object_allocator alloc = *this;
-        object->~Type();
-        alloc.deallocate(object, ed);
-    }
+  // Must be called on the pool of the calling worker, which need not be
+  // the pool the object was allocated from.
+  template <typename Type>
+  void delete_object(Type* object) {
+    object->~Type();
+    deallocate(object);
+  }
 
-    template <typename Type>
-    void delete_object(Type* object) {
-        small_object_allocator alloc = *this;
-        object->~Type();
-        alloc.deallocate(object);
+  void* allocate() {
+    if (!local_free) {
+      if (!reclaimed) reclaimed = remote_free.exchange(nullptr, std::memory_order_acquire);
+      if (reclaimed) {
+        block* b = reclaimed;
+        reclaimed = b->next;
+        ++remote_allocs;
+        return b;
+      }
+      if (carve == carve_end) add_slab();
+      void* b = carve;
+      carve += block_size;
+      ++local_allocs;
+      return b;
     }
+    block* b = local_free;
+    local_free = b->next;
+    ++local_allocs;
+    return b;
+  }
 
-    template <typename Type>
-    void deallocate(Type* ptr, const workerInfo& ed) {
-        assert(m_pool != nullptr);
-        deallocate(*m_pool, ptr, sizeof(Type), ed);
+  void deallocate(void* p) {
+    block* b = static_cast<block*>(p);
+    small_object_pool* owner = owner_of(p);
+    if (owner == this) {
+      b->next = local_free;
+      local_free = b;
+      return;
     }
+    block* head = owner->remote_free.load(std::memory_order_relaxed);
+    do {
+      b->next = head;
+    } while (!owner->remote_free.compare_exchange_weak(head, b, std::memory_order_release,
+                                                       std::memory_order_relaxed));
+    ++remote_frees;
+  }
 
-    template <typename Type>
-    void deallocate(Type* ptr) {
-        assert(m_pool != nullptr);
-        deallocate(*m_pool, ptr, sizeof(Type));
-    }
+  static small_object_pool* owner_of(void* p) {
+    auto slab = reinterpret_cast<slab_header*>(reinterpret_cast<std::uintptr_t>(p) & ~(slab_size - 1));
+    return slab->owner;
+  }
 
-private:
-    small_object_pool* m_pool{};
-};
+  // Allocations served from the pool's own frees and fresh slab space,
+  // allocations served from blocks other workers returned, and blocks
+  // this worker returned to other pools.
+  std::size_t local_allocs = 0;
+  std::size_t remote_allocs = 0;
+  std::size_t remote_frees = 0;
+
+ private:
+  struct block {
+    block* next;
+  };
+
+  struct alignas(block_size) slab_header {
+    small_object_pool* owner;
+    slab_header* next;
+  };
 
+  void add_slab() {
+    void* mem = std::aligned_alloc(slab_size, slab_size);
+    if (!mem) throw std::bad_alloc();
+    auto slab = new (mem) slab_header{this, slabs};
+    slabs = slab;
+    carve = static_cast<char*>(mem) + sizeof(slab_header);
+    carve_end = static_cast<char*>(mem) + slab_size;
+  }
 
+  // Owner only.
+  block* local_free = nullptr;
+  block* reclaimed = nullptr;
+  char* carve = nullptr;
+  char* carve_end = nullptr;
+  slab_header* slabs = nullptr;
+
+  // Pushed to by every other worker.
+  alignas(64) std::atomic<block*> remote_free{nullptr};
+};
@@ -0,0 +1,163 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../coroutine.h"
+
+// fib and cilksort written once with parallel_do and once as coroutine
+// tasks joined by when_all. Besides the time, each run reports how far
+// the stack of any worker grew between the shallowest and the deepest
+// leaf it ran, which for parallel_do includes the joins blocked under
+// stolen work.
+
+static thread_local std::uintptr_t stack_low = UINTPTR_MAX;
+static thread_local std::uintptr_t stack_high = 0;
+static thread_local int stack_run = -1;
+static std::atomic<std::uintptr_t> max_stack_span{0};
+static std::atomic<int> run{0};
+
+inline void note_stack() {
+  char here;
+  auto p = reinterpret_cast<std::uintptr_t>(&here);
+  // The main thread takes part in every run.
+  if (stack_run != run.load(std::memory_order_relaxed)) {
+    stack_run = run.load(std::memory_order_relaxed);
+    stack_low = UINTPTR_MAX;
+    stack_high = 0;
+  }
+  stack_low = std::min(stack_low, p);
+  stack_high = std::max(stack_high, p);
+  auto span = stack_high - stack_low;
+  if (span > max_stack_span.load(std::memory_order_relaxed))
+    max_stack_span.store(span, std::memory_order_relaxed);
+}
+
+unsigned long long fibonacci_seq(size_t n) {
+  if (n < 2) return n;
+  return fibonacci_seq(n - 1) + fibonacci_seq(n - 2);
+}
+
+unsigned long long fibonacci(size_t n) {
+  if (n <= 15) {
+    note_stack();
+    return fibonacci_seq(n);
+  }
+  unsigned long long x = 0, y = 0;
+  parallel_do([&]() { x = fibonacci(n - 1); },
+              [&]() { y = fibonacci(n - 2); });
+  return x + y;
+}
+
+task<unsigned long long> fibonacci_task(size_t n) {
+  if (n <= 15) {
+    note_stack();
+    co_return fibonacci_seq(n);
+  }
+  auto [x, y] = co_await when_all(fibonacci_task(n - 1), fibonacci_task(n - 2));
+  co_return x + y;
+}
+
+void merge_leaf(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  note_stack();
+  std::merge(a, a + na, b, b + nb, out);
+}
+
+void sort_leaf(int* a, size_t n) {
+  note_stack();
+  std::sort(a, a + n);
+}
+
+// Merge sort that splits both the sort and the merge.
+void cilkmerge(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  if (na < nb) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  if (na + nb <= 2048) return merge_leaf(a, na, b, nb, out);
+  size_t ma = na / 2;
+  size_t mb = std::lower_bound(b, b + nb, a[ma]) - b;
+  parallel_do([&]() { cilkmerge(a, ma, b, mb, out); },
+              [&]() { cilkmerge(a + ma, na - ma, b + mb, nb - mb, out + ma + mb); });
+}
+
+void cilksort(int* a, int* tmp, size_t n) {
+  if (n <= 2048) return sort_leaf(a, n);
+  size_t half = n / 2;
+  parallel_do([&]() { cilksort(a, tmp, half); },
+              [&]() { cilksort(a + half, tmp + half, n - half); });
+  cilkmerge(a, half, a + half, n - half, tmp);
+  std::copy(tmp, tmp + n, a);
+}
+
+task<> cilkmerge_task(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  if (na < nb) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  if (na + nb <= 2048) {
+    merge_leaf(a, na, b, nb, out);
+    co_return;
+  }
+  size_t ma = na / 2;
+  size_t mb = std::lower_bound(b, b + nb, a[ma]) - b;
+  co_await when_all(cilkmerge_task(a, ma, b, mb, out),
+                    cilkmerge_task(a + ma, na - ma, b + mb, nb - mb, out + ma + mb));
+}
+
+task<> cilksort_task(int* a, int* tmp, size_t n) {
+  if (n <= 2048) {
+    sort_leaf(a, n);
+    co_return;
+  }
+  size_t half = n / 2;
+  co_await when_all(cilksort_task(a, tmp, half),
+                    cilksort_task(a + half, tmp + half, n - half));
+  co_await cilkmerge_task(a, half, a + half, n - half, tmp);
+  std::copy(tmp, tmp + n, a);
+}
+
+// Runs f on a fresh scheduler, returns seconds.
+template <typename F>
+double timed(unsigned int p, F&& f) {
+  double seconds = 0;
+  max_stack_span = 0;
+  run++;
+  execute_with_scheduler(p, [&]() {
+    auto start = std::chrono::high_resolution_clock::now();
+    f();
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    seconds = diff.count();
+  });
+  return seconds;
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+
+  std::cout << "Benchmark, parallel_do (s), stack span (B), task (s), stack span (B)\n";
+  unsigned long long r1 = 0, r2 = 0;
+  double t1 = timed(p, [&]() { r1 = fibonacci(36); });
+  auto s1 = max_stack_span.load();
+  double t2 = timed(p, [&]() { r2 = sync_wait(fibonacci_task(36)); });
+  auto s2 = max_stack_span.load();
+  if (r1 != r2) std::cout << "fib results differ: " << r1 << " " << r2 << "\n";
+  std::cout << "fib(36), " << t1 << ", " << s1 << ", " << t2 << ", " << s2 << "\n";
+
+  const size_t n = 10000000;
+  std::vector<int> data(n), tmp(n);
+  std::mt19937 gen(42);
+  for (auto& x : data) x = gen();
+  std::vector<int> copy = data;
+  t1 = timed(p, [&]() { cilksort(data.data(), tmp.data(), n); });
+  s1 = max_stack_span.load();
+  t2 = timed(p, [&]() { sync_wait(cilksort_task(copy.data(), tmp.data(), n)); });
+  s2 = max_stack_span.load();
+  if (!std::is_sorted(data.begin(), data.end()) || data != copy) std::cout << "cilksort results differ\n";
+  std::cout << "cilksort(" << n << "), " << t1 << ", " << s1 << ", " << t2 << ", " << s2 << "\n";
+  return 0;
+}
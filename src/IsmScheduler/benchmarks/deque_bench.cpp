@@ -24,6 +24,8 @@
 #include <atomic>
 #include <random>
 #include <chrono>
+#include <algorithm>
+#include "../chev_lev.h"
 // Custom work-stealing deque (from your provided code)
 template <typename Job>
 struct Deque {
@@ -245,7 +247,81 @@ void worker_stddeque(std::deque<Node*>& deque, std::vector<std::deque<Node*>>& d
     }
 }
 
+// ****************** Batch stealing on WorkStealingQueue ******************
+// One owner starts with a wide flat loop of tasks in its queue, like the
+// first level of a parfor, and the thieves spread it out. Counts the
+// successful steals and the time until every thief had work.
+struct steal_result {
+    long long steals;
+    double saturation_us;
+    double total_ms;
+    long long ran_once;
+};
+
+void spin_work(int iterations) {
+    volatile int sink = 0;
+    for (int i = 0; i < iterations; ++i) sink = sink + i;
+}
+
+steal_result spread_tasks(int num_threads, int num_tasks, bool batched) {
+    std::vector<WorkStealingQueue<Node*>> queues(num_threads);
+    std::vector<Node> tasks(num_tasks, Node{0, 0});
+    for (auto& t : tasks) queues[0].push(&t);
+
+    std::atomic<long long> steals{0}, processed{0};
+    std::atomic<int> saturated{1};  // The owner starts with work.
+    std::atomic<long long> saturation_ns{0};
+    auto start = std::chrono::high_resolution_clock::now();
+
+    auto work = [&](int id) {
+        bool had_work = id == 0;
+        std::mt19937 gen(id);
+        while (processed.load(std::memory_order_relaxed) < num_tasks) {
+            auto task = queues[id].pop();
+            if (!task) {
+                int victim = gen() % num_threads;
+                if (victim == id) continue;
+                task = batched && queues[victim].size() >= 4
+                         ? queues[victim].steal_batch(64, queues[id])
+                         : queues[victim].steal();
+                if (!task) continue;
+                steals.fetch_add(1, std::memory_order_relaxed);
+                if (!had_work) {
+                    had_work = true;
+                    if (saturated.fetch_add(1) + 1 == num_threads) {
+                        saturation_ns = std::chrono::duration_cast<std::chrono::nanoseconds>(
+                            std::chrono::high_resolution_clock::now() - start).count();
+                    }
+                }
+            }
+            spin_work(2000);
+            (*task)->depth++;
+            processed.fetch_add(1, std::memory_order_relaxed);
+        }
+    };
+    std::vector<std::thread> threads;
+    for (int i = 0; i < num_threads; ++i) threads.emplace_back(work, i);
+    for (auto& t : threads) t.join();
+    std::chrono::duration<double, std::milli> total = std::chrono::high_resolution_clock::now() - start;
+    // Every task has to run exactly once.
+    long long once = std::count_if(tasks.begin(), tasks.end(), [](const Node& n) { return n.depth == 1; });
+    return {steals.load(), saturation_ns.load() / 1e3, total.count(), once};
+}
+
 int main() {
+    {
+        const int num_threads = std::max(4u, std::thread::hardware_concurrency());
+        const int num_tasks = 100000;
+        std::cout << "Threads: " << num_threads << ", tasks: " << num_tasks << "\n";
+        std::cout << "Steal, total steals, time to saturation (us), total time (ms), ran once\n";
+        for (bool batched : {false, true}) {
+            auto r = spread_tasks(num_threads, num_tasks, batched);
+            std::cout << (batched ? "batch" : "single") << ", " << r.steals << ", "
+                      << r.saturation_us << ", " << r.total_ms << ", " << r.ran_once << "\n";
+        }
+        std::cout << "\n";
+    }
+
     int num_threads = 1;  // Number of worker threads
     int execution_time = 1;  // Time in seconds for which the benchmark runs
 
@@ -0,0 +1,157 @@
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <memory>
+#include <thread>
+#include <vector>
+#include "../split_deque.h"
+
+// The deque layout before compaction: a fixed array of 20000 slots,
+// each padded to a cache line.
+template <typename Job>
+struct PaddedDeque {
+    using qidx = unsigned int;
+    using tag_t = unsigned int;
+
+    struct alignas(int64_t) age_t {
+        tag_t tag;
+        qidx top;
+    };
+
+    struct alignas(64) padded_job {
+        std::atomic<Job*> job;
+    };
+
+    static constexpr int q_size = 20000;
+    std::atomic<qidx> bot;
+    std::atomic<age_t> age;
+    std::array<padded_job, q_size> deq;
+
+    PaddedDeque() : bot(0), age(age_t{0, 0}) {}
+
+    // The slots are part of the object itself.
+    size_t footprint() const { return 0; }
+
+    bool push_bottom(Job* job) {
+        auto local_bot = bot.load(std::memory_order_acquire);
+        deq[local_bot].job.store(job, std::memory_order_release);
+        local_bot += 1;
+        if (local_bot == q_size) {
+            std::cerr << "internal error: scheduler queue overflow\n";
+            std::abort();
+        }
+        bot.store(local_bot, std::memory_order_seq_cst);
+        return true;
+    }
+
+    Job* pop_bottom() {
+        Job* result = nullptr;
+        auto local_bot = bot.load(std::memory_order_acquire);
+        if (local_bot != 0) {
+            local_bot--;
+            bot.store(local_bot, std::memory_order_release);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            auto job = deq[local_bot].job.load(std::memory_order_acquire);
+            auto old_age = age.load(std::memory_order_acquire);
+            if (local_bot > old_age.top)
+                result = job;
+            else {
+                bot.store(0, std::memory_order_release);
+                auto new_age = age_t{old_age.tag + 1, 0};
+                if ((local_bot == old_age.top) &&
+                    age.compare_exchange_strong(old_age, new_age))
+                    result = job;
+                else {
+                    age.store(new_age, std::memory_order_seq_cst);
+                    result = nullptr;
+                }
+            }
+        }
+        return result;
+    }
+
+    std::pair<Job*, bool> pop_top() {
+        auto old_age = age.load(std::memory_order_acquire);
+        auto local_bot = bot.load(std::memory_order_acquire);
+        if (local_bot > old_age.top) {
+            auto job = deq[old_age.top].job.load(std::memory_order_acquire);
+            auto new_age = old_age;
+            new_age.top = new_age.top + 1;
+            if (age.compare_exchange_strong(old_age, new_age))
+                return {job, (local_bot == old_age.top + 1)};
+            else
+                return {nullptr, (local_bot == old_age.top + 1)};
+        }
+        return {nullptr, true};
+    }
+};
+
+struct Task {
+    int value;
+};
+
+// Bytes a scheduler with one deque per worker commits after each deque
+// held `depth` tasks at its peak.
+template <template <typename> class D>
+size_t working_set(size_t workers, size_t depth, std::vector<Task>& tasks) {
+    auto deques = std::make_unique<D<Task>[]>(workers);
+    size_t bytes = 0;
+    for (size_t w = 0; w < workers; ++w) {
+        for (size_t i = 0; i < depth; ++i) deques[w].push_bottom(&tasks[i]);
+        while (deques[w].pop_bottom()) {}
+        bytes += sizeof(D<Task>) + deques[w].footprint();
+    }
+    return bytes;
+}
+
+// The owner keeps `depth` tasks in its deque while the thieves steal,
+// returns stolen tasks per second.
+template <template <typename> class D>
+double steal_throughput(int thieves, size_t depth, std::vector<Task>& tasks) {
+    auto deque = std::make_unique<D<Task>>();
+    std::atomic<bool> stop{false};
+    std::atomic<long long> stolen{0};
+    std::vector<std::thread> threads;
+    for (int t = 0; t < thieves; ++t) {
+        threads.emplace_back([&]() {
+            long long local = 0;
+            while (!stop.load(std::memory_order_relaxed)) {
+                if (deque->pop_top().first) ++local;
+            }
+            stolen += local;
+        });
+    }
+    const auto start = std::chrono::steady_clock::now();
+    const auto deadline = start + std::chrono::milliseconds(200);
+    while (std::chrono::steady_clock::now() < deadline) {
+        for (size_t i = 0; i < depth; ++i) deque->push_bottom(&tasks[i]);
+        while (deque->pop_bottom()) {}
+    }
+    stop.store(true);
+    for (auto& t : threads) t.join();
+    std::chrono::duration<double> diff = std::chrono::steady_clock::now() - start;
+    return stolen.load() / diff.count();
+}
+
+int main() {
+    std::vector<Task> tasks(PaddedDeque<Task>::q_size);
+    const size_t workers = 128;
+
+    std::cout << "Working set of " << workers << " deques (bytes)\n";
+    std::cout << "Peak depth, padded, compact\n";
+    for (size_t depth : {16, 256, 1024, 10000}) {
+        std::cout << depth << ", " << working_set<PaddedDeque>(workers, depth, tasks)
+                  << ", " << working_set<Deque>(workers, depth, tasks) << "\n";
+    }
+
+    std::cout << "\nSteal throughput (tasks/s)\n";
+    std::cout << "Thieves, padded, compact\n";
+    const int max_thieves = std::max(1u, std::thread::hardware_concurrency() - 1);
+    for (int thieves = 1; thieves <= max_thieves; thieves *= 2) {
+        std::cout << thieves << ", " << steal_throughput<PaddedDeque>(thieves, 1024, tasks)
+                  << ", " << steal_throughput<Deque>(thieves, 1024, tasks) << "\n";
+    }
+    return 0;
+}
@@ -4,6 +4,8 @@
 #include <tbb/tbb.h>
 #include <vector>
 #include <functional>
+#include <thread>
+#include "../parallel_for.h"
 
 static int w, n;
 
@@ -12,17 +14,51 @@ int loop() {
     for (int i = 0; i < n; i++) {
         s += i;
     }
-    return s;
+    // Keeps the loop from being optimised away.
+    volatile int sink = s;
+    return sink;
 }
 
 void tree(int depth) {
     if (depth > 0) {
-       tbb::parallel_invoke(
+        parallel_invoke(
             [=] { tree(depth - 1); },
             [=] { tree(depth - 1); },
             [=] { tree(depth - 1); },
             [=] { tree(depth - 1); }
-        );    } else {
+        );
+    } else {
+        loop();
+    }
+}
+
+// The same fork as three nested parallel_do calls.
+void tree_nested(int depth) {
+    if (depth > 0) {
+        parallel_do(
+            [=] { tree_nested(depth - 1); },
+            [=] {
+                parallel_do(
+                    [=] { tree_nested(depth - 1); },
+                    [=] {
+                        parallel_do([=] { tree_nested(depth - 1); },
+                                    [=] { tree_nested(depth - 1); });
+                    });
+            });
+    } else {
+        loop();
+    }
+}
+
+void tree_tbb(int depth) {
+    if (depth > 0) {
+        tbb::parallel_invoke(
+            [=] { tree_tbb(depth - 1); },
+            [=] { tree_tbb(depth - 1); },
+            [=] { tree_tbb(depth - 1); },
+            [=] { tree_tbb(depth - 1); }
+        );
+    } else {
         loop();
     }
 }
@@ -34,7 +70,7 @@ double wctime() {
 }
 
 void usage(const char* s) {
-    std::cerr << s << " <depth> <width> <grain> <reps>\n";
+    std::cerr << s << " <depth> <width> <grain> <reps> [workers]\n";
 }
 
 int main(int argc, char** argv) {
@@ -47,20 +83,36 @@ int main(int argc, char** argv) {
     w = std::atoi(argv[2]);
     n = std::atoi(argv[3]);
     int m = std::atoi(argv[4]);
+    unsigned int p = argc > 5 ? std::atoi(argv[5]) : std::thread::hardware_concurrency();
 
-    std::cout << "Running parallel depth first search on " << m 
-              << " balanced trees with depth " << d 
+    std::cout << "Running parallel depth first search on " << m
+              << " balanced trees with depth " << d
               << ", width " << w << ", grain " << n << ".\n";
 
-    double t1 = wctime();
+    double t1, t2;
+    execute_with_scheduler(p, [&]() {
+        t1 = wctime();
+        parallel_for(0, m, [d](size_t) {
+            tree(d);
+        }, 1);
+        t2 = wctime();
+        std::cout << "Time parallel_invoke: " << t2 - t1 << " seconds\n";
 
+        t1 = wctime();
+        parallel_for(0, m, [d](size_t) {
+            tree_nested(d);
+        }, 1);
+        t2 = wctime();
+        std::cout << "Time nested parallel_do: " << t2 - t1 << " seconds\n";
+    });
 
+    tbb::global_control control(tbb::global_control::max_allowed_parallelism, p);
+    t1 = wctime();
     tbb::parallel_for(0, m, [d](int) {
-        tree(d);
+        tree_tbb(d);
     });
-
-    double t2 = wctime();
-    std::cout << "Time: " << t2 - t1 << " seconds\n";
+    t2 = wctime();
+    std::cout << "Time TBB: " << t2 - t1 << " seconds\n";
 
     return 0;
 }
@@ -0,0 +1,63 @@
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include "../parallel_for.h"
+
+// fib with the hand-tuned sequential cutoff against fib without any
+// cutoff, once spawning at every parallel_do and once with heartbeat
+// scheduling, which only turns a branch into a task every
+// ISM_HEARTBEAT_US microseconds per worker.
+
+unsigned long long fibonacci_seq(size_t n) {
+  if (n < 2) return n;
+  return fibonacci_seq(n - 1) + fibonacci_seq(n - 2);
+}
+
+unsigned long long fibonacci_cutoff(size_t n) {
+  if (n <= 20) return fibonacci_seq(n);
+  unsigned long long x = 0, y = 0;
+  parallel_do([&]() { x = fibonacci_cutoff(n - 1); },
+              [&]() { y = fibonacci_cutoff(n - 2); });
+  return x + y;
+}
+
+unsigned long long fibonacci_spawn(size_t n) {
+  if (n < 2) return n;
+  unsigned long long x = 0, y = 0;
+  parallel_do([&]() { x = fibonacci_spawn(n - 1); },
+              [&]() { y = fibonacci_spawn(n - 2); });
+  return x + y;
+}
+
+unsigned long long fibonacci_heartbeat(size_t n) {
+  if (n < 2) return n;
+  unsigned long long x = 0, y = 0;
+  heartbeat_do([&]() { x = fibonacci_heartbeat(n - 1); },
+               [&]() { y = fibonacci_heartbeat(n - 2); });
+  return x + y;
+}
+
+template <typename F>
+double time_of(F&& f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  return diff.count();
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  execute_with_scheduler(p, [&]() {
+    std::cout << "n, cutoff 20, no cutoff, heartbeat no cutoff\n";
+    for (size_t n = 26; n <= 36; n += 2) {
+      unsigned long long a = 0, b = 0, c = 0;
+      double t_cutoff = time_of([&]() { a = fibonacci_cutoff(n); });
+      double t_spawn = time_of([&]() { b = fibonacci_spawn(n); });
+      double t_heartbeat = time_of([&]() { c = fibonacci_heartbeat(n); });
+      if (a != b || a != c) std::cout << "wrong result for " << n << "\n";
+      std::cout << n << ", " << t_cutoff << ", " << t_spawn << ", " << t_heartbeat << "\n";
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,79 @@
+#include <algorithm>
+#include <cstdlib>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include "../parallel_for.h"
+
+// Fences and CASes of the deque backend on fib and cilksort. Built once
+// per backend by the Makefile (lcws_abp, lcws_private) with
+// profiling_stats, the scheduler prints its counters when each run ends.
+
+unsigned long long fibonacci_seq(size_t n) {
+  if (n < 2) return n;
+  return fibonacci_seq(n - 1) + fibonacci_seq(n - 2);
+}
+
+unsigned long long fibonacci(size_t n) {
+  if (n <= 15) return fibonacci_seq(n);
+  unsigned long long x = 0, y = 0;
+  parallel_do([&]() { x = fibonacci(n - 1); },
+              [&]() { y = fibonacci(n - 2); });
+  return x + y;
+}
+
+// Merge sort that splits both the sort and the merge.
+void cilkmerge(const int* a, size_t na, const int* b, size_t nb, int* out) {
+  if (na < nb) {
+    std::swap(a, b);
+    std::swap(na, nb);
+  }
+  if (na + nb <= 2048) {
+    std::merge(a, a + na, b, b + nb, out);
+    return;
+  }
+  size_t ma = na / 2;
+  size_t mb = std::lower_bound(b, b + nb, a[ma]) - b;
+  parallel_do([&]() { cilkmerge(a, ma, b, mb, out); },
+              [&]() { cilkmerge(a + ma, na - ma, b + mb, nb - mb, out + ma + mb); });
+}
+
+void cilksort(int* a, int* tmp, size_t n) {
+  if (n <= 2048) {
+    std::sort(a, a + n);
+    return;
+  }
+  size_t half = n / 2;
+  parallel_do([&]() { cilksort(a, tmp, half); },
+              [&]() { cilksort(a + half, tmp + half, n - half); });
+  cilkmerge(a, half, a + half, n - half, tmp);
+  std::copy(tmp, tmp + n, a);
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  std::cout << "Deque backend: " << (ISM_PRIVATE_DEQUE ? "private/public" : "ABP") << "\n";
+
+  std::cout << "\nfib(35)\n";
+  execute_with_scheduler(p, [&]() {
+    auto start = std::chrono::high_resolution_clock::now();
+    auto res = fibonacci(35);
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "result " << res << ", time " << diff.count() << " s\n";
+  });
+
+  const size_t n = 10000000;
+  std::vector<int> data(n), tmp(n);
+  std::mt19937 gen(42);
+  for (auto& x : data) x = gen();
+  std::cout << "\ncilksort(" << n << ")\n";
+  execute_with_scheduler(p, [&]() {
+    auto start = std::chrono::high_resolution_clock::now();
+    cilksort(data.data(), tmp.data(), n);
+    std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+    std::cout << "sorted " << std::is_sorted(data.begin(), data.end()) << ", time " << diff.count() << " s\n";
+  });
+  return 0;
+}
@@ -1,4 +1,3 @@
-
 #include <iostream>
 #include <thread>
 #include <vector>
@@ -12,56 +11,72 @@ auto get_time() {
 }
 
 // Producer function to push tasks into the mail_outbox
-void producer(mail_outbox& outbox, int task_count) {
-    for (int i = 0; i < task_count; ++i) {
-        task_proxy* t = new task_proxy();  // Simulate task creation
+void producer(mail_outbox& outbox, std::vector<task_proxy*>& tasks, std::atomic<bool>& go) {
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    for (task_proxy* t : tasks) {
         outbox.push(t);
     }
 }
 
-// Consumer function to pop tasks from the mail_inbox and record time taken
-void consumer(mail_inbox& inbox, int task_count, std::atomic<long long>& total_pop_time) {
-    for (int i = 0; i < task_count; ++i) {
-        auto start = get_time();  // Start timing the pop
-        task_proxy* t = inbox.pop();
-        auto end = get_time();    // End timing the pop
-
-        if (t) {
-            // Record time taken for the pop operation
-            total_pop_time += std::chrono::duration_cast<std::chrono::nanoseconds>(end - start).count();
-            // Simulate task completion
-            delete t;
-        }
+// Consumer function to pop tasks from the mail_inbox until all task_count
+// tasks arrived, returns the pops per second.
+template <typename Pop>
+double consumer(int task_count, std::atomic<bool>& go, Pop pop) {
+    while (!go.load(std::memory_order_acquire)) std::this_thread::yield();
+    auto start = get_time();
+    int popped = 0;
+    while (popped < task_count) {
+        if (pop()) ++popped;
     }
+    auto end = get_time();
+    std::chrono::duration<double> diff = end - start;
+    return popped / diff.count();
 }
 
-int main() {
-    const int num_producers = 4;
-    const int num_consumers = 1;
-    const int tasks_per_producer = 10000;  // Number of tasks each producer will generate
-    std::atomic<long long> total_pop_time{0};  // To store total pop operation time
-
-    // Create the outbox and inbox
+// num_producers threads push into one outbox while the consumer drains
+// it, either one proxy at a time or in batches.
+double run(int num_producers, int tasks_per_producer, bool batched) {
     mail_outbox outbox;
     outbox.construct();  // Initialize the outbox
     mail_inbox inbox;
     inbox.attach(outbox);  // Attach inbox to outbox
 
-    // Create producer and consumer threads
-    std::thread producer_thread(producer, std::ref(outbox), tasks_per_producer);
-    std::thread consumer_thread(consumer, std::ref(inbox), tasks_per_producer, std::ref(total_pop_time));
+    // Tasks are created up front so that only the mailbox is measured.
+    std::vector<std::vector<task_proxy*>> tasks(num_producers);
+    for (auto& list : tasks)
+        for (int i = 0; i < tasks_per_producer; ++i) list.push_back(new task_proxy());
+
+    std::atomic<bool> go{false};
+    std::vector<std::thread> producers;
+    for (int p = 0; p < num_producers; ++p)
+        producers.emplace_back(producer, std::ref(outbox), std::ref(tasks[p]), std::ref(go));
+
+    const int task_count = num_producers * tasks_per_producer;
+    double pops_per_second = 0;
+    std::thread consumer_thread([&]() {
+        if (batched)
+            pops_per_second = consumer(task_count, go, [&]() { return inbox.pop(); });
+        else
+            pops_per_second = consumer(task_count, go, [&]() { return inbox.pop_one(); });
+    });
+    go.store(true, std::memory_order_release);
 
     // Join threads
-    producer_thread.join();
+    for (auto& t : producers) t.join();
     consumer_thread.join();
 
-    // Calculate the average time per pop operation
-    double average_pop_time = static_cast<double>(total_pop_time) / tasks_per_producer;
+    for (auto& list : tasks)
+        for (task_proxy* t : list) delete t;
+    return pops_per_second;
+}
+
+int main() {
+    const int tasks_per_producer = 10000;  // Number of tasks each producer will generate
 
-    // Output the results
-    //std::cout << "Total time taken for pop operations: " << total_pop_time.load() << " nanoseconds\n";
-    //std::cout << "Average time per pop operation: " << average_pop_time << " nanoseconds\n";
-    std::cout << average_pop_time << ", ";
+    std::cout << "Producers, pops/s one at a time, pops/s batched\n";
+    for (int num_producers = 1; num_producers <= 64; num_producers *= 2) {
+        std::cout << num_producers << ", " << run(num_producers, tasks_per_producer, false)
+                  << ", " << run(num_producers, tasks_per_producer, true) << "\n";
+    }
     return 0;
 }
-
@@ -0,0 +1,119 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <cstring>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <linux/perf_event.h>
+#include <sys/ioctl.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#include "../parallel_for.h"
+
+// n x n double matrix product, parallel over rows as matmul.cpp does
+// and over square tiles with parallel_for_2d, the k loop blocked by the
+// same tile side. Cache misses are counted with perf_event_open. The
+// kernel has no generic L2 event, so the last level and the L1 data
+// cache are counted instead. Without a PMU, or with perf_event_paranoid
+// above 2, they read n/a.
+
+class miss_counter {
+ public:
+  miss_counter(uint64_t cache) {
+    perf_event_attr attr;
+    std::memset(&attr, 0, sizeof(attr));
+    attr.size = sizeof(attr);
+    attr.type = PERF_TYPE_HW_CACHE;
+    attr.config = cache | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+    attr.disabled = 1;
+    attr.exclude_kernel = 1;
+    attr.exclude_hv = 1;
+    // Counts the workers too. Their counts are added in when they exit,
+    // so every version runs in a scheduler of its own.
+    attr.inherit = 1;
+    fd_ = static_cast<int>(syscall(SYS_perf_event_open, &attr, 0, -1, -1, 0));
+  }
+  ~miss_counter() {
+    if (fd_ >= 0) close(fd_);
+  }
+  void start() {
+    if (fd_ < 0) return;
+    ioctl(fd_, PERF_EVENT_IOC_RESET, 0);
+    ioctl(fd_, PERF_EVENT_IOC_ENABLE, 0);
+  }
+  // Misses since start, or n/a.
+  std::string stop() {
+    if (fd_ < 0) return "n/a";
+    ioctl(fd_, PERF_EVENT_IOC_DISABLE, 0);
+    uint64_t count = 0;
+    if (read(fd_, &count, sizeof(count)) != sizeof(count)) return "n/a";
+    return std::to_string(count);
+  }
+
+ private:
+  int fd_;
+};
+
+template <typename F>
+double seconds(F&& f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  return diff.count();
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const size_t n = argc > 2 ? std::atoll(argv[2]) : 1536;
+  const size_t tile = argc > 3 ? std::atoll(argv[3]) : cache_tile_side(sizeof(double), 3);
+
+  std::vector<double> a(n * n), b(n * n), c(n * n), expected(n * n);
+  for (size_t i = 0; i < n * n; ++i) {
+    a[i] = static_cast<double>(i % 17) - 8;
+    b[i] = static_cast<double>(i % 13) - 6;
+  }
+
+  miss_counter llc(PERF_COUNT_HW_CACHE_LL), l1d(PERF_COUNT_HW_CACHE_L1D);
+  std::cout << "n " << n << ", tile " << tile << ", workers " << p << "\n";
+  std::cout << "Version, time (s), LLC misses, L1D misses\n";
+  auto measure = [&](const char* name, auto&& product) {
+    double t = 0;
+    llc.start();
+    l1d.start();
+    execute_with_scheduler(p, [&]() { t = seconds(product); });
+    std::cout << name << ", " << t << ", " << llc.stop() << ", " << l1d.stop() << "\n";
+  };
+
+  measure("rows", [&]() {
+    parallel_for(0, n, [&](size_t i) {
+      double* ci = &expected[i * n];
+      for (size_t k = 0; k < n; ++k) {
+        const double aik = a[i * n + k];
+        const double* bk = &b[k * n];
+        for (size_t j = 0; j < n; ++j) ci[j] += aik * bk[j];
+      }
+    }, 1);
+  });
+
+  measure("tiles", [&]() {
+    parallel_for_2d(0, n, 0, n, [&](const tbb::blocked_range2d<size_t>& r) {
+      for (size_t k0 = 0; k0 < n; k0 += tile) {
+        const size_t k1 = std::min(n, k0 + tile);
+        for (size_t i = r.rows().begin(); i != r.rows().end(); ++i) {
+          double* ci = &c[i * n];
+          for (size_t k = k0; k < k1; ++k) {
+            const double aik = a[i * n + k];
+            const double* bk = &b[k * n];
+            for (size_t j = r.cols().begin(); j != r.cols().end(); ++j) ci[j] += aik * bk[j];
+          }
+        }
+      }
+    }, tile);
+  });
+
+  // Integer valued and well within 2^53, so the sums are exact.
+  if (c != expected) std::cout << "products differ\n";
+  return 0;
+}
@@ -0,0 +1,108 @@
+#include <atomic>
+#include <chrono>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+#include <tbb/tbb.h>
+#include "../parallel_for.h"
+
+// Reductions three ways: every chunk adding into one shared atomic, as
+// pi_mc.cpp does, parallel_reduce, and tbb::parallel_reduce. The pi
+// estimate is compute bound, the array sum memory bound and written so
+// that the chunk loop vectorises.
+
+long long count_inside(size_t begin, size_t end) {
+  std::mt19937 gen(begin);
+  std::uniform_real_distribution<double> dist(0.0, 1.0);
+  long long inside = 0;
+  for (size_t i = begin; i != end; ++i) {
+    double x = dist(gen);
+    double y = dist(gen);
+    inside += x * x + y * y <= 1.0;
+  }
+  return inside;
+}
+
+long long sum_chunk(const int* a, size_t begin, size_t end, long long acc) {
+  for (size_t i = begin; i != end; ++i) acc += a[i];
+  return acc;
+}
+
+template <typename F>
+double seconds(F&& f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  return diff.count();
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  tbb::global_control control(tbb::global_control::max_allowed_parallelism, p);
+
+  const size_t points = 50000000;
+  // Seeding the generator of a chunk alone takes longer than the
+  // measured grain, so the pi loops get a fixed one.
+  const long pi_grain = 10000;
+  const size_t n = 100000000;
+  std::vector<int> a(n);
+  for (size_t i = 0; i < n; ++i) a[i] = static_cast<int>(i % 1000);
+  const long long expected_sum = (n / 1000) * 499500LL;
+
+  execute_with_scheduler(p, [&]() {
+    std::cout << "Benchmark, atomic (s), parallel_reduce (s), tbb (s)\n";
+
+    long long pi_atomic = 0, pi_reduce = 0, pi_tbb = 0;
+    double t_atomic = seconds([&]() {
+      std::atomic<long long> inside{0};
+      parallel_for_morsel(0, points, [&](const tbb::blocked_range<size_t>& r) {
+        inside.fetch_add(count_inside(r.begin(), r.end()));
+      }, pi_grain, false);
+      pi_atomic = inside.load();
+    });
+    double t_reduce = seconds([&]() {
+      pi_reduce = parallel_reduce_morsel(0, points, 0LL,
+          [](tbb::blocked_range<size_t> r, long long acc) { return acc + count_inside(r.begin(), r.end()); },
+          std::plus<long long>(), pi_grain);
+    });
+    double t_tbb = seconds([&]() {
+      pi_tbb = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, points, pi_grain), 0LL,
+          [](const tbb::blocked_range<size_t>& r, long long acc) { return acc + count_inside(r.begin(), r.end()); },
+          std::plus<long long>());
+    });
+    std::cout << "pi (" << 4.0 * pi_reduce / points << "), " << t_atomic << ", " << t_reduce << ", " << t_tbb << "\n";
+    // Chunks are seeded by their start, so only the sums of equal chunkings agree.
+    if (pi_atomic <= 0 || pi_reduce <= 0 || pi_tbb <= 0) std::cout << "pi counts are wrong\n";
+
+    long long s_atomic = 0, s_reduce = 0, s_tbb = 0;
+    t_atomic = seconds([&]() {
+      std::atomic<long long> sum{0};
+      parallel_for_morsel(0, n, [&](const tbb::blocked_range<size_t>& r) {
+        sum.fetch_add(sum_chunk(a.data(), r.begin(), r.end(), 0));
+      }, 0, false);
+      s_atomic = sum.load();
+    });
+    t_reduce = seconds([&]() {
+      s_reduce = parallel_reduce_morsel(0, n, 0LL,
+          [&](tbb::blocked_range<size_t> r, long long acc) { return sum_chunk(a.data(), r.begin(), r.end(), acc); },
+          std::plus<long long>());
+    });
+    double t_elementwise = seconds([&]() {
+      long long s = parallel_reduce(0, n, 0LL, [&](size_t i) { return (long long)a[i]; }, std::plus<long long>());
+      if (s != expected_sum) std::cout << "elementwise sum is wrong\n";
+    });
+    t_tbb = seconds([&]() {
+      s_tbb = tbb::parallel_reduce(tbb::blocked_range<size_t>(0, n), 0LL,
+          [&](const tbb::blocked_range<size_t>& r, long long acc) { return sum_chunk(a.data(), r.begin(), r.end(), acc); },
+          std::plus<long long>());
+    });
+    std::cout << "sum, " << t_atomic << ", " << t_reduce << ", " << t_tbb << "\n";
+    std::cout << "sum with parallel_reduce over elements, " << t_elementwise << "\n";
+    if (s_atomic != expected_sum || s_reduce != expected_sum || s_tbb != expected_sum)
+      std::cout << "sums are wrong\n";
+  });
+  return 0;
+}
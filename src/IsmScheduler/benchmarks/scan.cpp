@@ -0,0 +1,112 @@
+#include <array>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <functional>
+#include <iostream>
+#include <numeric>
+#include <thread>
+#include <vector>
+#include <tbb/tbb.h>
+#include "../parallel_for.h"
+
+// Prefix sums of n longs: std::inclusive_scan, parallel_inclusive_scan,
+// parallel_exclusive_scan and tbb::parallel_scan. The largest size
+// needs 24 GB and is skipped unless asked for with an argument.
+//
+// Prefix products of 2 x 2 matrices first check that the parallel scans
+// keep the operands in order, the product is associative but not
+// commutative. Sums of ints then check the vectorised path of
+// std::plus.
+
+template <typename F>
+double seconds(F&& f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  return diff.count();
+}
+
+void tbb_inclusive_scan(const std::vector<long>& in, std::vector<long>& out) {
+  tbb::parallel_scan(tbb::blocked_range<size_t>(0, in.size()), 0L,
+      [&](const tbb::blocked_range<size_t>& r, long sum, bool is_final) {
+        for (size_t i = r.begin(); i != r.end(); ++i) {
+          sum += in[i];
+          if (is_final) out[i] = sum;
+        }
+        return sum;
+      },
+      std::plus<long>());
+}
+
+// Entries wrap around, which keeps the product associative.
+using mat2 = std::array<uint32_t, 4>;
+
+mat2 mat_mul(const mat2& a, const mat2& b) {
+  return {a[0] * b[0] + a[1] * b[2], a[0] * b[1] + a[1] * b[3],
+          a[2] * b[0] + a[3] * b[2], a[2] * b[1] + a[3] * b[3]};
+}
+
+bool ordered_products(size_t n) {
+  std::vector<mat2> in(n), expected(n), out(n);
+  for (size_t i = 0; i < n; ++i) in[i] = {1, static_cast<uint32_t>(i % 5), static_cast<uint32_t>(i % 3), 1};
+  std::inclusive_scan(in.begin(), in.end(), expected.begin(), mat_mul);
+  parallel_inclusive_scan(in.begin(), in.end(), out.begin(), mat_mul);
+  if (out != expected) return false;
+  const mat2 id{1, 0, 0, 1};
+  parallel_exclusive_scan(in.begin(), in.end(), out.begin(), id, mat_mul);
+  if (out[0] != id) return false;
+  for (size_t i = 1; i < n; ++i)
+    if (out[i] != expected[i - 1]) return false;
+  return true;
+}
+
+// Sums of ints take the vectorised path, odd sizes run its scalar tails
+// too.
+bool vector_sums(size_t n) {
+  std::vector<int> in(n), expected(n), out(n);
+  for (size_t i = 0; i < n; ++i) in[i] = static_cast<int>(i % 11) - 5;
+  std::inclusive_scan(in.begin(), in.end(), expected.begin());
+  parallel_inclusive_scan(in.begin(), in.end(), out.begin(), std::plus<>());
+  if (out != expected) return false;
+  parallel_exclusive_scan(in.begin(), in.end(), out.begin(), 7, std::plus<int>());
+  if (out[0] != 7) return false;
+  for (size_t i = 1; i < n; ++i)
+    if (out[i] != expected[i - 1] + 7) return false;
+  return true;
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const size_t max_n = argc > 2 ? std::atoll(argv[2]) : 100000000;
+  tbb::global_control control(tbb::global_control::max_allowed_parallelism, p);
+
+  execute_with_scheduler(p, [&]() {
+    const size_t mats = 8 * scan_block_size<mat2>() + 17;
+    std::cout << "Ordered matrix products: " << (ordered_products(mats) ? "ok" : "WRONG") << "\n";
+    const bool sums = vector_sums(13) && vector_sums(8 * scan_block_size<int>() + 3);
+    std::cout << "Vectorised sums: " << (sums ? "ok" : "WRONG") << "\n";
+    std::cout << "n, std::inclusive_scan (s), inclusive (s), exclusive (s), tbb (s)\n";
+    for (size_t n = 1000000; n <= max_n; n *= 10) {
+      std::vector<long> in(n), expected(n), out(n);
+      for (size_t i = 0; i < n; ++i) in[i] = static_cast<long>(i % 7) - 3;
+
+      double t_seq = seconds([&]() { std::inclusive_scan(in.begin(), in.end(), expected.begin()); });
+      double t_inclusive = seconds([&]() {
+        parallel_inclusive_scan(in.begin(), in.end(), out.begin(), std::plus<long>());
+      });
+      bool correct = out == expected;
+      double t_exclusive = seconds([&]() {
+        parallel_exclusive_scan(in.begin(), in.end(), out.begin(), 0L, std::plus<long>());
+      });
+      correct = correct && out[0] == 0;
+      for (size_t i = 1; i < n && correct; ++i) correct = out[i] == expected[i - 1];
+      double t_tbb = seconds([&]() { tbb_inclusive_scan(in, out); });
+      correct = correct && out == expected;
+
+      std::cout << n << ", " << t_seq << ", " << t_inclusive << ", " << t_exclusive << ", " << t_tbb
+                << (correct ? "" : ", WRONG") << "\n";
+    }
+  });
+  return 0;
+}
@@ -0,0 +1,55 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include <tbb/tbb.h>
+#include "../parallel_sort.h"
+
+// parallel_sort against std::sort and tbb::parallel_sort on random ints,
+// on ints with only 100 distinct values, and on sorted input, for every
+// worker count from 1 to p in powers of two.
+
+template <typename F>
+double seconds(F&& f) {
+  auto start = std::chrono::high_resolution_clock::now();
+  f();
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  return diff.count();
+}
+
+int main(int argc, char** argv) {
+  const unsigned int max_p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const size_t n = argc > 2 ? std::atoll(argv[2]) : 100000000;
+
+  std::mt19937 gen(42);
+  std::vector<int> random(n), few(n), sorted(n);
+  for (size_t i = 0; i < n; ++i) {
+    random[i] = static_cast<int>(gen());
+    few[i] = static_cast<int>(gen() % 100);
+    sorted[i] = static_cast<int>(i);
+  }
+
+  std::cout << "Input, workers, std::sort (s), parallel_sort (s), tbb::parallel_sort (s)\n";
+  for (auto [name, input] : {std::pair<std::string, std::vector<int>*>{"random", &random},
+                             {"100 keys", &few}, {"sorted", &sorted}}) {
+    std::vector<int> expected = *input;
+    double t_std = seconds([&]() { std::sort(expected.begin(), expected.end()); });
+    for (unsigned int p = 1; p <= max_p; p *= 2) {
+      std::vector<int> a = *input;
+      double t_ism = 0;
+      execute_with_scheduler(p, [&]() { t_ism = seconds([&]() { parallel_sort(a.begin(), a.end()); }); });
+      bool correct = a == expected;
+      a = *input;
+      tbb::global_control control(tbb::global_control::max_allowed_parallelism, p);
+      double t_tbb = seconds([&]() { tbb::parallel_sort(a.begin(), a.end()); });
+      correct = correct && a == expected;
+      std::cout << name << ", " << p << ", " << t_std << ", " << t_ism << ", " << t_tbb
+                << (correct ? "" : ", WRONG") << "\n";
+    }
+  }
+  return 0;
+}
@@ -0,0 +1,81 @@
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "../parallel_for.h"
+
+// Latency of scheduler_ism::submit from threads outside the scheduler.
+// Every submitter queues jobs one after another and waits on each
+// handle. A job records when it starts, which gives the submit to start
+// latency, and the submitter records when wait returns. Both are
+// measured with idle workers and with the workers busy on a fine
+// grained parallel_for that a guest keeps running.
+
+uint64_t now_ns() {
+  return std::chrono::duration_cast<std::chrono::nanoseconds>(
+      std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void report(const char* name, std::vector<uint64_t>& ns) {
+  std::sort(ns.begin(), ns.end());
+  auto at = [&](double q) { return ns[static_cast<size_t>(q * (ns.size() - 1))]; };
+  std::cout << name << ", " << at(0.5) << ", " << at(0.9) << ", " << at(0.99) << ", " << ns.back() << "\n";
+}
+
+void run(scheduler_type& scheduler, const char* load, unsigned int submitters, size_t jobs) {
+  std::vector<std::vector<uint64_t>> to_start(submitters), to_wake(submitters);
+  std::vector<std::thread> threads;
+  for (unsigned int t = 0; t < submitters; ++t) {
+    threads.emplace_back([&, t]() {
+      for (size_t i = 0; i < jobs; ++i) {
+        uint64_t started = 0;
+        const uint64_t submitted = now_ns();
+        submit_handle h = scheduler.submit([&]() { started = now_ns(); });
+        h.wait();
+        const uint64_t woken = now_ns();
+        to_start[t].push_back(started - submitted);
+        to_wake[t].push_back(woken - submitted);
+      }
+    });
+  }
+  for (auto& thread : threads) thread.join();
+  std::vector<uint64_t> start_all, wake_all;
+  for (unsigned int t = 0; t < submitters; ++t) {
+    start_all.insert(start_all.end(), to_start[t].begin(), to_start[t].end());
+    wake_all.insert(wake_all.end(), to_wake[t].begin(), to_wake[t].end());
+  }
+  std::cout << load << "\n";
+  report("submit to start", start_all);
+  report("submit to wait returning", wake_all);
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const unsigned int submitters = argc > 2 ? std::atoi(argv[2]) : 4;
+  const size_t jobs = argc > 3 ? std::atoll(argv[3]) : 10000;
+
+  scheduler_type scheduler(scheduler_type::shared_t{1}, p);
+  std::cout << p << " workers, " << submitters << " submitting threads, " << jobs << " jobs each\n";
+  std::cout << "Latency (ns), p50, p90, p99, max\n";
+  run(scheduler, "idle workers", submitters, jobs);
+
+  std::atomic<bool> stop{false};
+  std::thread load([&]() {
+    scheduler.execute([&]() {
+      std::vector<double> a(1 << 16, 1.0);
+      while (!stop.load(std::memory_order_relaxed)) {
+        fork_join_scheduler::parfor(scheduler, 0, a.size(), [&](tbb::blocked_range<size_t> r) {
+          for (size_t i = r.begin(); i != r.end(); ++i) a[i] = a[i] * 0.5 + 0.5;
+        }, 256);
+      }
+    });
+  });
+  run(scheduler, "busy workers", submitters, jobs);
+  stop.store(true);
+  load.join();
+  return 0;
+}
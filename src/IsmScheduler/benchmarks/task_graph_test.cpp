@@ -0,0 +1,65 @@
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <thread>
+#include <vector>
+#include "../task_graph.h"
+
+// Regression test for joins that find entries other than their own at
+// the bottom of the deque. Nodes of a task graph spawn their ready
+// successors and return without joining them, and here every node also
+// runs nested parallel_for loops and parallel_invoke, whose joins used
+// to take such an entry for one of their own branches. Every node and
+// every loop iteration has to run exactly once, in every run.
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const int runs = argc > 2 ? std::atoi(argv[2]) : 50;
+  const size_t width = 16, depth = 8, n = 4096;
+
+  bool ok = true;
+  execute_with_scheduler(p, [&]() {
+    std::vector<std::atomic<int>> node_runs(width * depth);
+    std::vector<std::atomic<long>> sums(width * depth);
+    task_graph g;
+    for (size_t i = 0; i < width * depth; ++i) {
+      g.add_node([&, i]() {
+        node_runs[i].fetch_add(1, std::memory_order_relaxed);
+        // Two more from parallel_invoke.
+        std::atomic<long> sum{-2};
+        auto loop = [&]() {
+          parallel_for(0, n, [&](size_t j) {
+            // 0 + 1 + ... + 7 = 28
+            std::atomic<long> inner{-28};
+            parallel_for(0, 8, [&](size_t k) { inner.fetch_add(static_cast<long>(k)); }, 1);
+            sum.fetch_add(static_cast<long>(j) + inner.load(), std::memory_order_relaxed);
+          }, 64);
+        };
+        auto one = [&]() { sum.fetch_add(1, std::memory_order_relaxed); };
+        parallel_invoke(loop, one, one);
+        sums[i].store(sum.load(), std::memory_order_relaxed);
+      });
+    }
+    // Layer d + 1 depends on two nodes of layer d.
+    for (size_t d = 0; d + 1 < depth; ++d)
+      for (size_t i = 0; i < width; ++i) {
+        g.add_edge(d * width + i, (d + 1) * width + i);
+        g.add_edge(d * width + (i + 1) % width, (d + 1) * width + i);
+      }
+
+    const long expected = static_cast<long>(n * (n - 1) / 2);
+    for (int r = 0; r < runs && ok; ++r) {
+      g.run();
+      for (size_t i = 0; i < width * depth; ++i) {
+        if (node_runs[i].load() != r + 1 || sums[i].load() != expected) {
+          std::cout << "run " << r << ": node " << i << " ran " << node_runs[i].load()
+                    << " times, sum " << sums[i].load() << " instead of " << expected << "\n";
+          ok = false;
+          break;
+        }
+      }
+    }
+  });
+  std::cout << (ok ? "task_graph with nested joins: ok\n" : "task_graph with nested joins: FAILED\n");
+  return ok ? 0 : 1;
+}
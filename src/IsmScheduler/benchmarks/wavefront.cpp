@@ -0,0 +1,100 @@
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+#include "../task_graph.h"
+
+// Longest common subsequence of two strings, computed in blocks. Block
+// (i, j) needs the blocks left of and above it. The diagonal version
+// runs one parallel_for per anti-diagonal and waits for all of it before
+// the next one starts. The task graph has only the real dependencies,
+// and is built once and run repeatedly.
+
+const size_t n = 1 << 13;
+const size_t block = 256;
+const size_t blocks = n / block;
+
+struct lcs_table {
+  std::string a, b;
+  // Row i + 1, column j + 1 holds the LCS of a[0, i] and b[0, j].
+  std::vector<unsigned> t;
+
+  lcs_table(std::string x, std::string y) : a(std::move(x)), b(std::move(y)), t((n + 1) * (n + 1), 0) {}
+
+  unsigned& at(size_t i, size_t j) { return t[i * (n + 1) + j]; }
+
+  void fill_block(size_t bi, size_t bj) {
+    for (size_t i = bi * block + 1; i <= (bi + 1) * block; ++i)
+      for (size_t j = bj * block + 1; j <= (bj + 1) * block; ++j)
+        at(i, j) = a[i - 1] == b[j - 1] ? at(i - 1, j - 1) + 1 : std::max(at(i - 1, j), at(i, j - 1));
+  }
+
+  unsigned result() { return at(n, n); }
+};
+
+std::string random_string(std::mt19937& gen) {
+  std::string s(n, 'a');
+  for (auto& c : s) c = 'a' + gen() % 4;
+  return s;
+}
+
+int main(int argc, char** argv) {
+  const unsigned int p = argc > 1 ? std::atoi(argv[1]) : std::thread::hardware_concurrency();
+  const int runs = 5;
+  std::mt19937 gen(42);
+  lcs_table table(random_string(gen), random_string(gen));
+
+  auto start = std::chrono::high_resolution_clock::now();
+  for (size_t bi = 0; bi < blocks; ++bi)
+    for (size_t bj = 0; bj < blocks; ++bj) table.fill_block(bi, bj);
+  std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+  const unsigned expected = table.result();
+  double seq_time = diff.count();
+
+  double diagonal_time = 0, graph_time = 0, build_time = 0;
+  bool correct = true;
+  execute_with_scheduler(p, [&]() {
+    for (int r = 0; r < runs; ++r) {
+      std::fill(table.t.begin(), table.t.end(), 0);
+      auto start = std::chrono::high_resolution_clock::now();
+      for (size_t d = 0; d < 2 * blocks - 1; ++d) {
+        size_t first = d < blocks ? 0 : d - blocks + 1;
+        size_t last = std::min(d, blocks - 1);
+        parallel_for(first, last + 1, [&](size_t bi) { table.fill_block(bi, d - bi); }, 1);
+      }
+      std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+      diagonal_time += diff.count();
+      correct = correct && table.result() == expected;
+    }
+
+    auto start = std::chrono::high_resolution_clock::now();
+    task_graph graph;
+    for (size_t bi = 0; bi < blocks; ++bi)
+      for (size_t bj = 0; bj < blocks; ++bj) {
+        auto id = graph.add_node([&table, bi, bj]() { table.fill_block(bi, bj); });
+        if (bi > 0) graph.add_edge(id - blocks, id);
+        if (bj > 0) graph.add_edge(id - 1, id);
+      }
+    std::chrono::duration<double> built = std::chrono::high_resolution_clock::now() - start;
+    build_time = built.count();
+    for (int r = 0; r < runs; ++r) {
+      std::fill(table.t.begin(), table.t.end(), 0);
+      auto start = std::chrono::high_resolution_clock::now();
+      graph.run();
+      std::chrono::duration<double> diff = std::chrono::high_resolution_clock::now() - start;
+      graph_time += diff.count();
+      correct = correct && table.result() == expected;
+    }
+  });
+
+  std::cout << "LCS " << n << "x" << n << " in " << blocks << "x" << blocks << " blocks, "
+            << (correct ? "correct" : "WRONG") << "\n";
+  std::cout << "sequential (s), diagonals (s), task graph (s), graph build (s)\n";
+  std::cout << seq_time << ", " << diagonal_time / runs << ", " << graph_time / runs << ", "
+            << build_time << "\n";
+  return 0;
+}
@@ -1,8 +1,13 @@
 
 #pragma once
+#include <algorithm>
 #include <atomic>
+#include <cstdint>
 #include <optional>
+#include <thread>
+#include <utility>
 #include <vector>
+#include "epoch.h"
 #include "job.h" // Include the WorkStealingJob definition
 #define profiling_stats 1
 template <typename T>
@@ -37,7 +42,11 @@ class WorkStealingQueue {
     }
 
     Array* resize(int64_t b, int64_t t) {
-      Array* ptr = new Array {2*C};
+      return copy(b, t, 2*C);
+    }
+
+    Array* copy(int64_t b, int64_t t, int64_t c) {
+      Array* ptr = new Array {c};
       for(int64_t i=t; i!=b; ++i) {
         ptr->push(i, pop(i));
       }
@@ -45,10 +54,37 @@ class WorkStealingQueue {
     }
   };
 
+  // A batch stealer sets busy in _top while it copies its share, plain
+  // steals fail and the owner waits for it in pop.
+  static constexpr int64_t busy = int64_t{1} << 62;
+
   std::atomic<int64_t> _top;
   std::atomic<int64_t> _bottom;
   std::atomic<Array*> _array;
-  std::vector<Array*> _garbage;
+  // Arrays replaced by a resize, with the epoch they were retired in.
+  std::vector<std::pair<Array*, uint64_t>> _garbage;
+  const int64_t _min_capacity;
+
+  // Retire the current array for a copy of [t, b) with capacity c.
+  Array* replace(Array* a, int64_t b, int64_t t, int64_t c) {
+    Array* tmp = a->copy(b, t, c);
+    _array.store(tmp, std::memory_order_seq_cst);
+    _garbage.emplace_back(a, epoch::retire());
+    reclaim();
+    return tmp;
+  }
+
+  // Frees the arrays no stealer can still read, see epoch.h.
+  void reclaim() {
+    if(_garbage.empty()) return;
+    const uint64_t oldest = epoch::oldest_announced();
+    auto last = std::remove_if(_garbage.begin(), _garbage.end(), [&](const auto& g) {
+      if(g.second >= oldest) return false;
+      delete g.first;
+      return true;
+    });
+    _garbage.erase(last, _garbage.end());
+  }
 
 public:
 #ifdef profiling_stats
@@ -57,7 +93,9 @@ public:
 
 #endif //profiling_stats
 
-  explicit WorkStealingQueue(int64_t capacity = 1024) {
+  // The array grows when full and shrinks back, down to capacity, once
+  // it is less than a quarter full.
+  explicit WorkStealingQueue(int64_t capacity = 1024) : _min_capacity{capacity} {
     _top.store(0, std::memory_order_relaxed);
     _bottom.store(0, std::memory_order_relaxed);
     _array.store(new Array{capacity}, std::memory_order_relaxed);
@@ -66,22 +104,22 @@ public:
   }
 
   ~WorkStealingQueue() {
-    for(auto a : _garbage) {
-      //delete a;
+    for(auto& g : _garbage) {
+      delete g.first;
     }
     delete _array.load();
   }
 
   void push(T o) {
     int64_t b = _bottom.load(std::memory_order_relaxed);
-    int64_t t = _top.load(std::memory_order_acquire);
+    int64_t t = _top.load(std::memory_order_acquire) & ~busy;
     Array* a = _array.load(std::memory_order_relaxed);
 
     if(a->capacity() - 1 < (b - t)) {
-      Array* tmp = a->resize(b, t);
-      _garbage.push_back(a);
-      std::swap(a, tmp);
-      _array.store(a, std::memory_order_relaxed);
+      a = replace(a, b, t, 2 * a->capacity());
+    #ifdef profiling_stats
+      resize++;
+    #endif
     }
 
     a->push(b, o);
@@ -99,6 +137,12 @@ public:
     _bottom.store(b, std::memory_order_relaxed);
     std::atomic_thread_fence(std::memory_order_seq_cst);
     int64_t t = _top.load(std::memory_order_relaxed);
+    // A batch steal is in flight, it may have seen the old bottom and can
+    // take everything up to it when it holds only a single item.
+    while(t & busy) {
+      std::this_thread::yield();
+      t = _top.load(std::memory_order_acquire);
+    }
 
     std::optional<T> item;
 
@@ -124,10 +168,18 @@ public:
     fence++;
     popBottom++;
 #endif
+    if(a->capacity() > _min_capacity && 4 * size() < a->capacity()) {
+      // Give the memory of a burst back, the owner is the only writer.
+      int64_t nb = _bottom.load(std::memory_order_relaxed);
+      int64_t nt = _top.load(std::memory_order_acquire) & ~busy;
+      replace(a, nb, nt, a->capacity() / 2);
+    }
+    else reclaim();
     return item;
   }
 
   std::optional<T> steal() {
+    epoch::guard guard;
     int64_t t = _top.load(std::memory_order_acquire);
     std::atomic_thread_fence(std::memory_order_seq_cst);
     int64_t b = _bottom.load(std::memory_order_acquire);
@@ -157,6 +209,54 @@ public:
     return item;
   }
 
+  // Steals up to n items, but never more than half of the queue, from
+  // the top in one protocol step. Returns the oldest of them and pushes
+  // the rest onto into, which has to be the queue of the calling thread,
+  // in their original order.
+  //
+  // The thief locks _top by setting busy, then reads _bottom. The owner
+  // can not pop past a locked top, and leaving at least half of the items
+  // keeps the single pop the owner may have started clear of the batch.
+  std::optional<T> steal_batch(size_t n, WorkStealingQueue& into) {
+    epoch::guard guard;
+    int64_t t = _top.load(std::memory_order_acquire);
+    if(t & busy) return std::nullopt;
+    if(!_top.compare_exchange_strong(t, t | busy,
+                                     std::memory_order_seq_cst,
+                                     std::memory_order_relaxed)) {
+#ifdef profiling_stats
+      cas++;
+#endif
+      return std::nullopt;
+    }
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    int64_t b = _bottom.load(std::memory_order_acquire);
+
+    int64_t k = 0;
+    if(b - t == 1) k = 1;
+    else if(b - t > 1) k = std::min<int64_t>(static_cast<int64_t>(n), (b - t) / 2);
+
+    std::optional<T> item;
+    Array* a = _array.load(std::memory_order_consume);
+    if(k > 0) {
+      item = a->pop(t);
+      for(int64_t i = t + 1; i < t + k; ++i) into.push(a->pop(i));
+    }
+    _top.store(t + k, std::memory_order_release);
+#ifdef profiling_stats
+    fence++;
+    popTop++;
+    success += k;
+#endif
+    return item;
+  }
+
+  int64_t size() const noexcept {
+    int64_t b = _bottom.load(std::memory_order_relaxed);
+    int64_t t = _top.load(std::memory_order_relaxed) & ~busy;
+    return b > t ? b - t : 0;
+  }
+
   // Function: capacity
   int64_t capacity() const noexcept {
     return _array.load(std::memory_order_relaxed)->capacity();
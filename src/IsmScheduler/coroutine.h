@@ -0,0 +1,235 @@
+#pragma once
+#include <cassert>
+
+#include <atomic>
+#include <coroutine>
+#include <exception>
+#include <optional>
+#include <type_traits>
+#include <utility>
+#include <variant>
+
+#include "parallel_for.h"
+
+// Coroutine tasks on scheduler_ism.
+//
+// A task<T> starts when it is awaited. co_await when_all(a, b) forks
+// like parallel_do: b is spawned and a runs on the calling worker. But
+// where parallel_do keeps the joining frame on the stack and runs other
+// work on top of it in do_work_until, the parent here suspends, and
+// whichever worker finishes the last child resumes it. A frame waiting
+// at a join takes no stack, so steal chains do not pile up blocked
+// frames.
+//
+// Tasks have to be awaited on a worker of the current scheduler. The
+// outermost one is started with sync_wait.
+
+template <typename T = void>
+class task;
+
+// Resumes a coroutine. The job lives in the parent's frame, which may
+// be gone by the time the resumed coroutine suspends again.
+struct coroutine_job : WorkStealingJob {
+  coroutine_job() : WorkStealingJob(job_kind::detached) {}
+  std::coroutine_handle<> handle;
+
+ protected:
+  void execute() override { handle.resume(); }
+};
+
+// The join of one when_all, stored in the awaiting frame.
+struct fork_point {
+  std::atomic<int> pending{2};
+  bool right_spawned = false;
+  std::coroutine_handle<> parent;
+  coroutine_job right;
+
+  // True for the child that finishes last.
+  bool arrive() noexcept {
+    return pending.fetch_sub(1, std::memory_order_acq_rel) == 1;
+  }
+};
+
+struct task_promise_base {
+  // Exactly one of these says what happens when the task finishes.
+  std::coroutine_handle<> continuation;
+  fork_point* fork = nullptr;
+  std::atomic<bool>* root_done = nullptr;
+  bool is_left = false;
+  std::exception_ptr error;
+
+  struct final_awaiter {
+    bool await_ready() noexcept { return false; }
+    template <typename P>
+    std::coroutine_handle<> await_suspend(std::coroutine_handle<P> h) noexcept {
+      return h.promise().finish();
+    }
+    void await_resume() noexcept {}
+  };
+
+  std::suspend_always initial_suspend() noexcept { return {}; }
+  final_awaiter final_suspend() noexcept { return {}; }
+  void unhandled_exception() noexcept { error = std::current_exception(); }
+
+  // Picks the coroutine to continue with. Once the task arrived at its
+  // fork, the parent may resume and destroy this frame, so nothing here
+  // touches the promise after that.
+  std::coroutine_handle<> finish() noexcept {
+    if (root_done) {
+      root_done->store(true, std::memory_order_release);
+      return std::noop_coroutine();
+    }
+    if (!fork) return continuation ? continuation : std::noop_coroutine();
+    fork_point* f = fork;
+    if (!is_left) return f->arrive() ? f->parent : std::noop_coroutine();
+    const bool spawned = f->right_spawned;
+    WorkStealingJob* right = &f->right;
+    if (f->arrive()) return f->parent;
+    // The right child has not finished, so f stays alive as long as we
+    // own it. Run it here if nobody took it yet, like pardo does.
+    if (!spawned) return f->right.handle;
+    auto* scheduler = scheduler_ism<WorkStealingJob>::get_current_scheduler();
+    if (scheduler->try_reclaim(right)) return f->right.handle;
+    return std::noop_coroutine();
+  }
+
+  void rethrow_if_failed() {
+    if (error) std::rethrow_exception(error);
+  }
+};
+
+template <typename T>
+struct task_promise : task_promise_base {
+  std::optional<T> value;
+
+  template <typename U>
+  void return_value(U&& v) { value.emplace(std::forward<U>(v)); }
+
+  T result() {
+    rethrow_if_failed();
+    return std::move(*value);
+  }
+};
+
+template <>
+struct task_promise<void> : task_promise_base {
+  void return_void() noexcept {}
+  void result() { rethrow_if_failed(); }
+};
+
+template <typename T>
+class task {
+ public:
+  struct promise_type : task_promise<T> {
+    task get_return_object() noexcept {
+      return task(std::coroutine_handle<promise_type>::from_promise(*this));
+    }
+  };
+  using handle_type = std::coroutine_handle<promise_type>;
+
+  task(task&& other) noexcept : handle(std::exchange(other.handle, nullptr)) {}
+  task& operator=(task&& other) noexcept {
+    if (this != &other) {
+      if (handle) handle.destroy();
+      handle = std::exchange(other.handle, nullptr);
+    }
+    return *this;
+  }
+  task(const task&) = delete;
+  task& operator=(const task&) = delete;
+
+  ~task() {
+    if (handle) handle.destroy();
+  }
+
+  // Runs the task on the awaiting worker, without forking.
+  auto operator co_await() && noexcept {
+    struct awaiter {
+      handle_type h;
+      bool await_ready() noexcept { return false; }
+      std::coroutine_handle<> await_suspend(std::coroutine_handle<> awaiting) noexcept {
+        h.promise().continuation = awaiting;
+        return h;
+      }
+      T await_resume() { return h.promise().result(); }
+    };
+    return awaiter{handle};
+  }
+
+ private:
+  explicit task(handle_type h) noexcept : handle(h) {}
+
+  template <typename A, typename B>
+  friend class when_all_awaiter;
+  template <typename U>
+  friend U sync_wait(task<U> t);
+
+  handle_type handle;
+};
+
+// Awaits two tasks in parallel. Yields nothing if both are task<void>,
+// and a pair of their results otherwise, with std::monostate standing
+// in for void.
+template <typename A, typename B>
+class when_all_awaiter {
+ public:
+  when_all_awaiter(task<A> a, task<B> b) : left(std::move(a)), right(std::move(b)) {}
+
+  bool await_ready() noexcept { return false; }
+
+  std::coroutine_handle<> await_suspend(std::coroutine_handle<> parent) noexcept {
+    fork.parent = parent;
+    fork.right.handle = right.handle;
+    left.handle.promise().fork = &fork;
+    left.handle.promise().is_left = true;
+    right.handle.promise().fork = &fork;
+    auto* scheduler = scheduler_ism<WorkStealingJob>::get_current_scheduler();
+    assert(scheduler != nullptr);
+    // If the deque is full the left child runs the right one when done.
+    fork.right_spawned = scheduler->spawn_mailed(&fork.right);
+    return left.handle;
+  }
+
+  auto await_resume() {
+    if constexpr (std::is_void_v<A> && std::is_void_v<B>) {
+      left.handle.promise().result();
+      right.handle.promise().result();
+    } else {
+      // Braced initialisation takes the left result first.
+      return std::pair{take(left), take(right)};
+    }
+  }
+
+ private:
+  template <typename T>
+  static auto take(task<T>& t) {
+    if constexpr (std::is_void_v<T>) {
+      t.handle.promise().result();
+      return std::monostate{};
+    } else {
+      return t.handle.promise().result();
+    }
+  }
+
+  task<A> left;
+  task<B> right;
+  fork_point fork;
+};
+
+template <typename A, typename B>
+when_all_awaiter<A, B> when_all(task<A> a, task<B> b) {
+  return when_all_awaiter<A, B>(std::move(a), std::move(b));
+}
+
+// Runs t on the calling worker and helps with other work until it is
+// done.
+template <typename T>
+T sync_wait(task<T> t) {
+  return with_scheduler([&](scheduler_type& scheduler) -> T {
+    std::atomic<bool> done{false};
+    t.handle.promise().root_done = &done;
+    t.handle.resume();
+    scheduler.wait_until([&]() { return done.load(std::memory_order_acquire); });
+    return t.handle.promise().result();
+  });
+}
@@ -0,0 +1,100 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <limits>
+
+#include "cacheline.h"
+
+// Epoch based reclamation for the buffers of the work-stealing deques.
+//
+// Every thread that steals announces the global epoch in a record of its
+// own for the time it may hold a buffer pointer, which costs a store and
+// a fence on a line no other thread writes. An owner that replaces a
+// buffer advances the global epoch and tags the old buffer with the
+// epoch it retired in. The buffer is free once every announced epoch is
+// newer: a stealer that announced later can only load the new buffer.
+//
+// Records are never freed. A thread that exits hands its record to the
+// next thread that needs one.
+namespace epoch {
+
+inline constexpr uint64_t idle = std::numeric_limits<uint64_t>::max();
+
+struct alignas(libdb::NO_FALSE_SHARING_BYTES) record {
+  std::atomic<uint64_t> announced{idle};
+  std::atomic<bool> taken{true};
+  // Guards of the owning thread, they may nest.
+  unsigned int depth = 0;
+  record* next = nullptr;
+};
+
+namespace detail {
+
+inline std::atomic<uint64_t> global{0};
+inline std::atomic<record*> records{nullptr};
+
+inline record* acquire_record() {
+  for (record* r = records.load(std::memory_order_acquire); r; r = r->next) {
+    if (!r->taken.load(std::memory_order_relaxed) && !r->taken.exchange(true, std::memory_order_acquire))
+      return r;
+  }
+  record* r = new record;
+  record* head = records.load(std::memory_order_relaxed);
+  do {
+    r->next = head;
+  } while (!records.compare_exchange_weak(head, r, std::memory_order_release, std::memory_order_relaxed));
+  return r;
+}
+
+struct thread_record {
+  record* r = acquire_record();
+  ~thread_record() { r->taken.store(false, std::memory_order_release); }
+};
+
+inline record& local() {
+  static thread_local thread_record tr;
+  return *tr.r;
+}
+
+}  // namespace detail
+
+// Held by a stealer from before it loads the buffer until it is done
+// with it.
+class guard {
+ public:
+  guard() : r(detail::local()) {
+    if (r.depth++ == 0) {
+      r.announced.store(detail::global.load(std::memory_order_acquire), std::memory_order_relaxed);
+      // Orders the announcement before the load of the buffer pointer.
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+    }
+  }
+  ~guard() {
+    if (--r.depth == 0) r.announced.store(idle, std::memory_order_release);
+  }
+  guard(const guard&) = delete;
+  guard& operator=(const guard&) = delete;
+
+ private:
+  record& r;
+};
+
+// Called by the owner after it stored the new buffer pointer. Returns
+// the epoch to tag the old buffer with.
+inline uint64_t retire() {
+  return detail::global.fetch_add(1, std::memory_order_seq_cst);
+}
+
+// Buffers retired in an epoch older than this are free.
+inline uint64_t oldest_announced() {
+  // Pairs with the fence in guard, see retire.
+  std::atomic_thread_fence(std::memory_order_seq_cst);
+  uint64_t oldest = idle;
+  for (record* r = detail::records.load(std::memory_order_acquire); r; r = r->next) {
+    const uint64_t e = r->announced.load(std::memory_order_acquire);
+    if (e < oldest) oldest = e;
+  }
+  return oldest;
+}
+
+}  // namespace epoch
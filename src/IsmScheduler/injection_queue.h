@@ -0,0 +1,147 @@
+#pragma once
+#include <atomic>
+#include <cstdint>
+#include <exception>
+#include <utility>
+
+#include "atomic_wait.h"
+#include "cacheline.h"
+
+// Work that threads outside a scheduler hand to it.
+//
+// injection_queue is Vyukov's intrusive multi-producer single-consumer
+// queue: a push is one exchange on the tail and one store, so producers
+// never wait for each other or for the consumer. Idle workers all poll
+// it, and a try-lock makes sure only one of them pops at a time.
+//
+// submit_state is the completion of one submitted job, shared by the job
+// and the handle its submitter waits on. Waiting parks the thread on a
+// futex instead of spinning.
+
+struct injection_node {
+  std::atomic<injection_node*> next_injected{nullptr};
+};
+
+class injection_queue {
+ public:
+  injection_queue() : head(&stub), tail(&stub) {}
+
+  injection_queue(const injection_queue&) = delete;
+  injection_queue& operator=(const injection_queue&) = delete;
+
+  void push(injection_node* node) {
+    node->next_injected.store(nullptr, std::memory_order_relaxed);
+    injection_node* prev = tail.exchange(node, std::memory_order_acq_rel);
+    // Between the exchange and this store the queue is cut, and pops
+    // see it as empty past prev.
+    prev->next_injected.store(node, std::memory_order_release);
+  }
+
+  // Cheap enough to poll from every steal attempt, reads two lines that
+  // only change on a push or pop. Nodes are returned from head, so only
+  // the stub at both ends means empty, head == tail may be one node.
+  bool empty() const {
+    return head.load(std::memory_order_relaxed) == &stub && tail.load(std::memory_order_relaxed) == &stub;
+  }
+
+  // The oldest node, or nullptr if the queue is empty, another worker is
+  // popping, or the only node is still being linked in by its push.
+  injection_node* try_pop() {
+    if (empty()) return nullptr;
+    if (popping.load(std::memory_order_relaxed) || popping.exchange(true, std::memory_order_acquire))
+      return nullptr;
+    injection_node* node = pop();
+    popping.store(false, std::memory_order_release);
+    return node;
+  }
+
+ private:
+  injection_node* pop() {
+    injection_node* first = head.load(std::memory_order_relaxed);
+    injection_node* next = first->next_injected.load(std::memory_order_acquire);
+    if (first == &stub) {
+      if (!next) return nullptr;
+      head.store(next, std::memory_order_relaxed);
+      first = next;
+      next = next->next_injected.load(std::memory_order_acquire);
+    }
+    if (next) {
+      head.store(next, std::memory_order_relaxed);
+      return first;
+    }
+    if (tail.load(std::memory_order_acquire) != first) return nullptr;
+    // first is the last node. Queue the stub behind it, so that it can
+    // leave without the queue becoming headless.
+    push(&stub);
+    next = first->next_injected.load(std::memory_order_acquire);
+    if (!next) return nullptr;
+    head.store(next, std::memory_order_relaxed);
+    return first;
+  }
+
+  // Consumer side and producer side on lines of their own.
+  alignas(libdb::NO_FALSE_SHARING_BYTES) std::atomic<injection_node*> head;
+  std::atomic<bool> popping{false};
+  injection_node stub;
+  alignas(libdb::NO_FALSE_SHARING_BYTES) std::atomic<injection_node*> tail;
+};
+
+struct submit_state {
+  virtual ~submit_state() = default;
+
+  bool ready() const { return done.load(std::memory_order_acquire) != 0; }
+
+  void wait() const {
+    while (!ready()) parlay::atomic_wait(&done, 0u);
+  }
+
+  // Called once by the job after it ran.
+  void finish(std::exception_ptr e) {
+    error = std::move(e);
+    done.store(1, std::memory_order_release);
+    parlay::atomic_notify_all(&done);
+  }
+
+  // The job and the handle each hold one reference.
+  void release() {
+    if (refs.fetch_sub(1, std::memory_order_acq_rel) == 1) delete this;
+  }
+
+  std::exception_ptr error;
+
+ private:
+  std::atomic<uint32_t> done{0};
+  std::atomic<uint32_t> refs{2};
+};
+
+// Handle of a job queued with scheduler_ism::submit.
+class submit_handle {
+ public:
+  submit_handle() = default;
+  explicit submit_handle(submit_state* s) : state(s) {}
+  submit_handle(submit_handle&& other) noexcept : state(std::exchange(other.state, nullptr)) {}
+  submit_handle& operator=(submit_handle&& other) noexcept {
+    if (this != &other) {
+      if (state) state->release();
+      state = std::exchange(other.state, nullptr);
+    }
+    return *this;
+  }
+  ~submit_handle() {
+    if (state) state->release();
+  }
+
+  bool valid() const { return state != nullptr; }
+  bool ready() const { return state->ready(); }
+
+  // Parks the calling thread until the job has run, and rethrows what it
+  // threw. A worker of the scheduler should rather help while it waits,
+  // with wait_until([&] { return h.ready(); }).
+  void wait() {
+    state->wait();
+    if (state->error) std::rethrow_exception(state->error);
+  }
+
+ private:
+  submit_state* state = nullptr;
+};
@@ -7,12 +7,21 @@
 #include <chrono>
 #include <iostream>
 
+// Lets the scheduler tell task proxies from plain jobs with one load
+// instead of a dynamic_cast on every pop. A detached job may be freed
+// while it executes, so it is never marked finished.
+enum class job_kind : unsigned char { plain, proxy, detached };
+
 struct WorkStealingJob {
-  WorkStealingJob() : done{false} { }
+  explicit WorkStealingJob(job_kind k = job_kind::plain) : done{false}, kind{k} { }
   virtual ~WorkStealingJob() = default;
   
   void operator()() {
     assert(done.load(std::memory_order_relaxed) == false);
+    if (kind == job_kind::detached) {
+      execute();
+      return;
+    }
     //auto executionTime = std::chrono::high_resolution_clock::now();
     execute();
     //auto end = std::chrono::high_resolution_clock::now();
@@ -31,10 +40,15 @@ struct WorkStealingJob {
     while (!finished())
       std::this_thread::yield();
   }
+
+  [[nodiscard]] bool is_proxy() const noexcept {
+    return kind == job_kind::proxy;
+  }
   
  protected:
   virtual void execute() = 0;
   std::atomic<bool> done;
+  const job_kind kind;
   //std::chrono::time_point<std::chrono::high_resolution_clock> creationTime;
 };
 
@@ -19,6 +19,13 @@ struct task_proxy : public WorkStealingJob {
     mail_outbox* outbox;
     worker_id_type slot;
 
+    task_proxy() : WorkStealingJob(job_kind::proxy) {}
+
+    // The proxy behind a job popped from a deque, or nullptr for a plain job.
+    static task_proxy* from(WorkStealingJob* job) {
+        return job->is_proxy() ? static_cast<task_proxy*>(job) : nullptr;
+    }
+
     static bool is_shared(intptr_t tat) {
         return (tat & location_mask) == location_mask;
     }
@@ -154,6 +161,24 @@ private:
         return curr;
     }
 
+    // Takes the whole list with one exchange on my_last and returns its
+    // first proxy, or nullptr if the box is empty. last is set to the link
+    // of the final proxy. Links before it may still be filled in by
+    // producers that are mid-push, so readers wait for them to appear.
+    task_proxy* internal_pop_all(atomic_proxy_ptr*& last) {
+        task_proxy* first = my_first.load(std::memory_order_acquire);
+        if (!first)
+            return nullptr;
+        // Only the owner pops, so first stays valid, and producers that
+        // see the reset my_last link to my_first from now on.
+        my_first.store(nullptr, std::memory_order_relaxed);
+        last = my_last.exchange(&my_first);
+        #ifdef profiling_stats
+         cas++;
+        #endif
+        return first;
+    }
+
 };
 
 
@@ -161,6 +186,9 @@ private:
 class mail_inbox{
   //! Corresponding sink where mail that we receive will be put.
     mail_outbox* my_putter;
+    //! Mail taken from the outbox but not yet handed out, owner only.
+    task_proxy* my_private_first = nullptr;
+    std::atomic<task_proxy*>* my_private_last = nullptr;
 public:
     //! Construct unattached inbox
     mail_inbox() : my_putter(nullptr) {}
@@ -176,12 +204,36 @@ public:
         my_putter = nullptr;
     }
     //! Get next piece of mail, or nullptr if mailbox is empty.
-    task_proxy* pop(  ) {
-        return my_putter->internal_pop( );
+    /** Refills a private list from the outbox in one exchange, so that a
+        worker with many mails touches the shared outbox once per batch. */
+    task_proxy* pop() {
+        if (!my_private_first) {
+            my_private_first = my_putter->internal_pop_all(my_private_last);
+            if (!my_private_first)
+                return nullptr;
+        }
+        task_proxy* curr = my_private_first;
+        if (&curr->next_in_mailbox == my_private_last) {
+            my_private_first = nullptr;
+        } else {
+            // A producer has swung my_last past curr but not linked it yet.
+            task_proxy* next;
+            while (!(next = curr->next_in_mailbox.load(std::memory_order_acquire)))
+                std::this_thread::yield();
+            my_private_first = next;
+        }
+        #ifdef profiling_stats
+         my_putter->extract++;
+        #endif
+        return curr;
+    }
+    //! Get next piece of mail directly from the outbox, bypassing the private list.
+    task_proxy* pop_one() {
+        return my_putter->internal_pop();
     }
     //! Return true if mailbox is empty
     bool empty() {
-        return my_putter->empty();
+        return !my_private_first && my_putter->empty();
     }
     //! Indicate whether thread that reads this mailbox is idle.
     /** Raises assertion failure if mailbox is redundantly marked as not idle. */
@@ -12,6 +12,8 @@
 #include <utility>
 #include <vector>
 
+#include "epoch.h"
+
 // This (stand-alone) file implements the deque described in the papers, "Correct and Efficient
 // Work-Stealing for Weak Memory Models," and "Dynamic Circular Work-Stealing Deque". Both are
 // available in 'reference/'.
@@ -42,7 +44,12 @@ namespace detail {
 
         // Allocates and returns a new ring buffer, copies elements in range [b, t) into the new buffer.
         RingBuff<T>* resize(std::int64_t b, std::int64_t t) const {
-            RingBuff<T>* ptr = new RingBuff{2 * _cap};
+            return copy(b, t, 2 * _cap);
+        }
+
+        // Same as resize but with the given capacity, which must hold [b, t).
+        RingBuff<T>* copy(std::int64_t b, std::int64_t t, std::int64_t cap) const {
+            RingBuff<T>* ptr = new RingBuff{cap};
             for (std::int64_t i = t; i != b; ++i) {
                 ptr->store(i, load(i));
             }
@@ -69,6 +76,10 @@ inline constexpr std::size_t hardware_destructive_interference_size = 2 * sizeof
 // operations where the deque behaves like a stack. Others can (only) steal data from the deque, they see
 // a FIFO queue. All threads must have finished using the deque before it is destructed. T must be
 // default initializable, trivially destructible and have nothrow move constructor/assignment operators.
+//
+// The buffer doubles when full and halves, down to the initial capacity, once it is less than a
+// quarter full. Replaced buffers are freed by the owner once no stealer can still read them, see
+// epoch.h.
 template <typename T> class Deque {
   public:
     // Constructs the deque with a given capacity the capacity of the deque (must be power of 2)
@@ -108,7 +119,19 @@ template <typename T> class Deque {
     alignas(hardware_destructive_interference_size) std::atomic<std::int64_t> _bottom;
     alignas(hardware_destructive_interference_size) std::atomic<detail::RingBuff<T>*> _buffer;
 
-    std::vector<std::unique_ptr<detail::RingBuff<T>>> _garbage;  // Store old buffers here.
+    // Store old buffers here, with the epoch they were retired in.
+    std::vector<std::pair<std::unique_ptr<detail::RingBuff<T>>, std::uint64_t>> _garbage;
+
+    std::int64_t _min_capacity;
+
+    // Swap in a copy of [t, b) with the given capacity and retire the old buffer.
+    detail::RingBuff<T>* replace(detail::RingBuff<T>* buf, std::int64_t b, std::int64_t t, std::int64_t cap);
+
+    // Free retired buffers if no stealer can still read them.
+    void reclaim() noexcept;
+
+    // Owner only, halves the buffer once it is less than a quarter full.
+    void shrink_if_sparse(detail::RingBuff<T>* buf) noexcept;
 
     // Convenience aliases.
     static constexpr std::memory_order relaxed = std::memory_order_relaxed;
@@ -119,7 +142,7 @@ template <typename T> class Deque {
 };
 
 template <typename T> Deque<T>::Deque(std::int64_t cap)
-    : _top(0), _bottom(0), _buffer(new detail::RingBuff<T>{cap}) {
+    : _top(0), _bottom(0), _buffer(new detail::RingBuff<T>{cap}), _min_capacity(cap) {
     _garbage.reserve(32);
 }
 
@@ -145,8 +168,7 @@ template <typename T> template <typename... Args> void Deque<T>::push_bottom(Arg
 
     if (buf->capacity() < (b - t) + 1) {
         // Queue is full, build a new one
-        _garbage.emplace_back(std::exchange(buf, buf->resize(b, t)));
-        _buffer.store(buf, relaxed);
+        buf = replace(buf, b, t, 2 * buf->capacity());
     }
 
     // Construct new object, this does not have to be atomic as no one can steal this item until after we
@@ -173,6 +195,7 @@ template <typename T> std::optional<T> Deque<T>::pop_bottom() noexcept {
             if (!_top.compare_exchange_strong(t, t + 1, seq_cst, relaxed)) {
                 // Failed race, thief got the last item.
                 _bottom.store(b + 1, relaxed);
+                shrink_if_sparse(buf);
                 return std::nullopt;
             }
             _bottom.store(b + 1, relaxed);
@@ -180,15 +203,33 @@ template <typename T> std::optional<T> Deque<T>::pop_bottom() noexcept {
 
         // Can delay load until after acquiring slot as only this thread can push(), this load is not
         // required to be atomic as we are the exclusive writer.
-        return buf->load(b);
+        T x = buf->load(b);
+        shrink_if_sparse(buf);
+        return x;
 
     } else {
         _bottom.store(b + 1, relaxed);
+        shrink_if_sparse(buf);
         return std::nullopt;
     }
 }
 
+template <typename T> void Deque<T>::shrink_if_sparse(detail::RingBuff<T>* buf) noexcept {
+    if (buf->capacity() > _min_capacity && 4 * static_cast<std::int64_t>(size()) < buf->capacity()) {
+        // Hand back the memory of a burst, keeping the larger buffer if that is not possible.
+        try {
+            replace(buf, _bottom.load(relaxed), _top.load(acquire), buf->capacity() / 2);
+        } catch (std::bad_alloc const&) {
+        }
+    } else {
+        reclaim();
+    }
+}
+
 template <typename T> std::optional<T> Deque<T>::pop_top() noexcept {
+    // Announced before the buffer is loaded and until we are done with it, see reclaim().
+    epoch::guard guard;
+
     std::int64_t t = _top.load(acquire);
     std::atomic_thread_fence(seq_cst);
     std::int64_t b = _bottom.load(acquire);
@@ -214,5 +255,23 @@ template <typename T> std::optional<T> Deque<T>::pop_top() noexcept {
     }
 }
 
+template <typename T>
+detail::RingBuff<T>* Deque<T>::replace(detail::RingBuff<T>* buf, std::int64_t b, std::int64_t t,
+                                       std::int64_t cap) {
+    _garbage.reserve(_garbage.size() + 1);  // Nothing below may throw once the copy exists.
+    detail::RingBuff<T>* next = buf->copy(b, t, cap);
+    _buffer.store(next, seq_cst);
+    _garbage.emplace_back(buf, epoch::retire());
+    reclaim();
+    return next;
+}
+
+template <typename T> void Deque<T>::reclaim() noexcept {
+    if (_garbage.empty()) return;
+    // A stealer that announced after the store of _buffer in replace() can only load the new buffer.
+    std::uint64_t const oldest = epoch::oldest_announced();
+    std::erase_if(_garbage, [&](auto const& g) { return g.second < oldest; });
+}
+
 template <typename T> Deque<T>::~Deque() noexcept { delete _buffer.load(); }
 
@@ -1,10 +1,16 @@
 
 #include <cassert>
 #include <cstdlib>
+#include <cstring>
 
 #include <algorithm>
 #include <functional>
+#include <iterator>
+#include <memory>
+#include <numeric>
 #include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/blocked_range2d.h>
+#include <oneapi/tbb/blocked_range3d.h>
 #include <string>
 #include <thread>
 #include <type_traits>  // IWYU pragma: keep
@@ -21,15 +27,72 @@ template <typename F>
 inline void parallel_for(size_t start, size_t end, F&& f, long granularity = 0,
                          bool conservative = false);
 
+// Runs f over tiles of [row_begin, row_end) x [col_begin, col_end),
+// passed as tbb::blocked_range2d<size_t>, in recursive order. Tiles are
+// at most grain long in each dimension, see cache_tile_side for a grain
+// that fits the L2. The default suits three tiles of doubles.
+template <typename F>
+inline void parallel_for_2d(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
+                            F&& f, size_t grain = 0, bool conservative = false);
+
+// parallel_for_2d with a third, outermost dimension, f takes a
+// tbb::blocked_range3d<size_t>.
+template <typename F>
+inline void parallel_for_3d(size_t page_begin, size_t page_end, size_t row_begin, size_t row_end,
+                            size_t col_begin, size_t col_end, F&& f, size_t grain = 0,
+                            bool conservative = false);
+
+// Reduces map(i) over [start, end) with combine, which has to be
+// associative. identity must be neutral for combine.
+template <typename T, typename M, typename C>
+inline T parallel_reduce(size_t start, size_t end, T identity, M&& map, C&& combine,
+                         long granularity = 0, bool conservative = false);
+
+// Like parallel_reduce, but f(range, acc) folds a whole chunk into acc,
+// so the loop over it can be vectorised.
+template <typename T, typename F, typename C>
+inline T parallel_reduce_morsel(size_t start, size_t end, T identity, F&& f, C&& combine,
+                                long granularity = 0, bool conservative = false);
+
+// Parallel std::inclusive_scan and std::exclusive_scan. op has to be
+// associative, but operands are never swapped, so it need not be
+// commutative. Returns the end of the output like the std versions.
+// Sums of integers or floating point values with std::plus over
+// contiguous ranges are vectorised in both passes, other scans run
+// scalar, see simd_plus_scan.
+template <typename InIt, typename OutIt, typename Op>
+inline OutIt parallel_inclusive_scan(InIt first, InIt last, OutIt out, Op op);
+
+template <typename InIt, typename OutIt, typename T, typename Op>
+inline OutIt parallel_exclusive_scan(InIt first, InIt last, OutIt out, T init, Op op);
+
+// Runs all of fs in parallel and returns once they are done. Unlike
+// nested parallel_do calls, the branches are spawned with one push and
+// joined with one counter.
+template <typename... Fs>
+inline void parallel_invoke(Fs&&... fs);
+
 template <typename Lf, typename Rf>
-inline void parallel_invoke(Lf&& left, Rf&& right, bool conservative = false);
+inline void heartbeat_do(Lf&& left, Rf&& right, bool conservative = false);
+
+// True if parallel_do should use heartbeat scheduling, see
+// fork_join_scheduler::heartbeat_pardo.
+//
+// Default: false
+#ifndef ISM_HEARTBEAT
+#define ISM_HEARTBEAT false
+#endif
 
 template <typename Lf, typename Rf>
 inline void parallel_do(Lf&& left, Rf&& right, bool conservative = false) {
   static_assert(std::is_invocable_v<Lf&&>);
   static_assert(std::is_invocable_v<Rf&&>);
   
+#if ISM_HEARTBEAT
+  heartbeat_do(std::forward<Lf>(left), std::forward<Rf>(right), conservative);
+#else
   par_do(std::forward<Lf>(left), std::forward<Rf>(right), conservative);
+#endif
   }
 
 #include "schedule.h"
@@ -46,18 +109,40 @@ inline unsigned int init_num_workers() {
     return std::thread::hardware_concurrency();
 }
 using scheduler_type = scheduler_ism< WorkStealingJob>;
+
+// Threads that the process-wide scheduler takes as guests at a time,
+// further ones wait for a slot. 0 means as many as it has workers.
+//
+// Default: 0
+#ifndef ISM_EXTERNAL_SLOTS
+#define ISM_EXTERNAL_SLOTS 0
+#endif
+
+// The scheduler of threads that do not belong to one. Its workers are
+// all spawned, so however many threads call into it, the process runs
+// a single pool.
+inline scheduler_type& shared_scheduler() {
+  static scheduler_type scheduler(
+      scheduler_type::shared_t{ISM_EXTERNAL_SLOTS ? ISM_EXTERNAL_SLOTS : init_num_workers()}, init_num_workers());
+  return scheduler;
+}
+
 extern inline scheduler_type& get_current_scheduler() {
   auto current_scheduler = scheduler_type::get_current_scheduler();
-  if (current_scheduler == nullptr) {
-    static thread_local scheduler_type local_scheduler(init_num_workers());
-
-    //std::cout << get_time_parallel_for()<< std::endl; 
-    return local_scheduler;
-  }
-  //std::cout << get_time_parallel_for()<< std::endl; 
+  if (current_scheduler == nullptr) return shared_scheduler();
   return *current_scheduler;
 }
 
+// Runs f(scheduler) on the scheduler of the calling thread, or as a
+// guest of the shared one, see scheduler_ism::execute, for threads
+// outside any scheduler.
+template <typename F>
+inline decltype(auto) with_scheduler(F&& f) {
+  if (auto* current = scheduler_type::get_current_scheduler()) return f(*current);
+  auto& shared = shared_scheduler();
+  return shared.execute([&]() -> decltype(auto) { return f(shared); });
+}
+
 
 inline size_t num_workers() {
   return get_current_scheduler().num_workers();
@@ -80,8 +165,10 @@ inline void parallel_for(size_t start, size_t end, F&& f, long granularity, bool
     //f(tbb::blocked_range<size_t>(start,end));
   }
   else if (end > start) {
-    fork_join_scheduler::parfor(get_current_scheduler(), start, end,
-    wrapper_lambda, static_cast<size_t>(granularity), conservative);
+    with_scheduler([&](scheduler_type& scheduler) {
+      fork_join_scheduler::parfor(scheduler, start, end,
+      wrapper_lambda, static_cast<size_t>(granularity), conservative);
+    });
   }
 }
 
@@ -92,19 +179,287 @@ inline void parallel_for_morsel(size_t start, size_t end, F&& f, long granularit
     f(tbb::blocked_range<size_t>(start,end));
   }
   else if (end > start) {
-    fork_join_scheduler::parfor(get_current_scheduler(), start, end,
-    std::forward<F>(f), static_cast<size_t>(granularity), conservative);
+    with_scheduler([&](scheduler_type& scheduler) {
+      fork_join_scheduler::parfor(scheduler, start, end,
+      std::forward<F>(f), static_cast<size_t>(granularity), conservative);
+    });
   }
 }
 
+template <typename T, typename F, typename C>
+inline T parallel_reduce_morsel(size_t start, size_t end, T identity, F&& f, C&& combine, long granularity, bool conservative) {
+  static_assert(std::is_invocable_r_v<T, F&, tbb::blocked_range<size_t>, T>);
+  static_assert(std::is_invocable_r_v<T, C&, T, T>);
+  if (end <= start) return identity;
+  if ((end - start) <= static_cast<size_t>(granularity)) {
+    return f(tbb::blocked_range<size_t>(start, end), std::move(identity));
+  }
+  return with_scheduler([&](scheduler_type& scheduler) {
+    return fork_join_scheduler::parreduce(scheduler, start, end, std::move(identity),
+      std::forward<F>(f), std::forward<C>(combine), static_cast<size_t>(granularity), conservative);
+  });
+}
+
+template <typename T, typename M, typename C>
+inline T parallel_reduce(size_t start, size_t end, T identity, M&& map, C&& combine, long granularity, bool conservative) {
+  static_assert(std::is_invocable_v<M&, size_t>);
+  auto fold = [&](tbb::blocked_range<size_t> range, T acc) {
+    for (size_t i = range.begin(); i != range.end(); ++i) acc = combine(std::move(acc), map(i));
+    return acc;
+  };
+  return parallel_reduce_morsel(start, end, std::move(identity), fold, combine, granularity, conservative);
+}
+
+// Elements per block of the scans, so that a block of input and its
+// output fit in the L2 together.
+template <typename T>
+inline size_t scan_block_size() {
+  static const size_t l2 = cpu_topology::cache_size(2, 1 << 20);
+  return std::max<size_t>(l2 / (2 * sizeof(T)), 1024);
+}
+
+// Sums and scans of arithmetic values in vectors of 16 bytes, the SSE2
+// width that every x86-64 build has. The sums are regrouped, so for
+// floating point they may round differently from a serial scan, like
+// std::reduce does.
+namespace simd_plus {
+
+template <typename T>
+struct vec {
+  typedef T type __attribute__((vector_size(16)));
+  static constexpr size_t width = 16 / sizeof(T);
+};
+
+template <typename T>
+inline typename vec<T>::type load(const T* p) {
+  typename vec<T>::type v;
+  std::memcpy(&v, p, sizeof v);
+  return v;
+}
+
+template <typename T>
+inline void store(T* p, typename vec<T>::type v) {
+  std::memcpy(p, &v, sizeof v);
+}
+
+// Lane i of the result is lane i - K of v, the lanes below K are 0.
+template <size_t K, typename V, size_t... I>
+inline V shift_up(V v, std::index_sequence<I...>) {
+  const V zero{};
+  return __builtin_shufflevector(zero, v, (I < K ? I : sizeof...(I) + I - K)...);
+}
+
+// Inclusive scan of the lanes of v, in log2(width) shifted adds.
+template <typename T, size_t K = 1>
+inline typename vec<T>::type prefix(typename vec<T>::type v) {
+  if constexpr (K < vec<T>::width)
+    return prefix<T, 2 * K>(v + shift_up<K>(v, std::make_index_sequence<vec<T>::width>{}));
+  else
+    return v;
+}
+
+template <typename T>
+inline T sum(const T* in, size_t n) {
+  constexpr size_t w = vec<T>::width;
+  typename vec<T>::type acc{};
+  size_t i = 0;
+  for (; i + w <= n; i += w) acc += load(in + i);
+  T total{};
+  for (size_t l = 0; l < w; ++l) total += acc[l];
+  for (; i < n; ++i) total += in[i];
+  return total;
+}
+
+// out may be in, every vector is loaded before it is overwritten.
+template <typename T>
+inline void inclusive_scan(const T* in, size_t n, T* out, T carry) {
+  constexpr size_t w = vec<T>::width;
+  size_t i = 0;
+  for (; i + w <= n; i += w) {
+    const auto v = prefix<T>(load(in + i)) + carry;
+    store(out + i, v);
+    carry = v[w - 1];
+  }
+  for (; i < n; ++i) out[i] = carry += in[i];
+}
+
+template <typename T>
+inline void exclusive_scan(const T* in, size_t n, T* out, T carry) {
+  constexpr size_t w = vec<T>::width;
+  size_t i = 0;
+  for (; i + w <= n; i += w) {
+    const auto v = prefix<T>(load(in + i));
+    store(out + i, shift_up<1>(v, std::make_index_sequence<w>{}) + carry);
+    carry += v[w - 1];
+  }
+  for (; i < n; ++i) {
+    const T x = in[i];
+    out[i] = carry;
+    carry += x;
+  }
+}
+
+}  // namespace simd_plus
+
+// True if a scan with op from InIt to OutIt and T as the type of init
+// adds integers or floating point values of one type in contiguous
+// memory, so that it can take the simd_plus path.
+template <typename Op, typename T, typename InIt, typename OutIt>
+inline constexpr bool simd_plus_scan =
+    ((std::is_integral_v<T> && !std::is_same_v<T, bool>) || std::is_same_v<T, float> ||
+     std::is_same_v<T, double>) &&
+    (std::is_same_v<Op, std::plus<T>> || std::is_same_v<Op, std::plus<>>) &&
+    std::contiguous_iterator<InIt> && std::contiguous_iterator<OutIt> &&
+    std::is_same_v<std::iter_value_t<InIt>, T> && std::is_same_v<std::iter_value_t<OutIt>, T>;
+
+// Reduces the non-empty range [first, last) as a balanced tree that
+// keeps the operands in order, so op only has to be associative. Runs
+// of up to 64 elements at the leaves are folded left to right.
+template <typename T, typename It, typename Op>
+inline T ordered_reduce(It first, It last, Op& op) {
+  const auto n = std::distance(first, last);
+  if (n <= 64) {
+    T acc(*first);
+    for (auto it = std::next(first); it != last; ++it) acc = op(std::move(acc), *it);
+    return acc;
+  }
+  const auto mid = std::next(first, n / 2);
+  return op(ordered_reduce<T>(first, mid, op), ordered_reduce<T>(mid, last, op));
+}
+
+// Two-pass blocked scan. The first pass reduces every block, with
+// simd_plus::sum if Fast and with ordered_reduce otherwise. The block
+// totals are then scanned serially, and the second pass scans every
+// block starting from the total of the blocks before it.
+// scan_block(b, carry) runs the second pass of block b, with carry
+// unset for the first block.
+template <typename InIt, typename T, bool Fast, typename Op, typename ScanBlock>
+inline void blocked_scan(InIt first, size_t n, size_t block, Op& op, ScanBlock&& scan_block) {
+  const size_t num_blocks = (n + block - 1) / block;
+  std::vector<T> totals(num_blocks);
+  parallel_for(0, num_blocks, [&](size_t b) {
+    auto begin = first + b * block;
+    auto end = first + std::min(n, (b + 1) * block);
+    if constexpr (Fast) totals[b] = simd_plus::sum(std::to_address(begin), end - begin);
+    else totals[b] = ordered_reduce<T>(begin, end, op);
+  }, 1);
+  for (size_t b = 1; b < num_blocks; ++b) totals[b] = op(totals[b - 1], totals[b]);
+  parallel_for(0, num_blocks, [&](size_t b) {
+    scan_block(b, b == 0 ? nullptr : &totals[b - 1]);
+  }, 1);
+}
+
+template <typename InIt, typename OutIt, typename Op>
+inline OutIt parallel_inclusive_scan(InIt first, InIt last, OutIt out, Op op) {
+  using T = typename std::iterator_traits<InIt>::value_type;
+  constexpr bool fast = simd_plus_scan<Op, T, InIt, OutIt>;
+  const size_t n = std::distance(first, last);
+  const size_t block = scan_block_size<T>();
+  if (n <= block) {
+    if constexpr (fast) simd_plus::inclusive_scan(std::to_address(first), n, std::to_address(out), T{});
+    else std::inclusive_scan(first, last, out, op);
+    return out + n;
+  }
+  blocked_scan<InIt, T, fast>(first, n, block, op, [&](size_t b, const T* carry) {
+    auto begin = first + b * block;
+    auto end = first + std::min(n, (b + 1) * block);
+    if constexpr (fast)
+      simd_plus::inclusive_scan(std::to_address(begin), end - begin, std::to_address(out + b * block),
+                                carry ? *carry : T{});
+    else if (carry) std::inclusive_scan(begin, end, out + b * block, op, *carry);
+    else std::inclusive_scan(begin, end, out + b * block, op);
+  });
+  return out + n;
+}
+
+template <typename InIt, typename OutIt, typename T, typename Op>
+inline OutIt parallel_exclusive_scan(InIt first, InIt last, OutIt out, T init, Op op) {
+  using V = typename std::iterator_traits<InIt>::value_type;
+  constexpr bool fast = simd_plus_scan<Op, T, InIt, OutIt>;
+  const size_t n = std::distance(first, last);
+  const size_t block = scan_block_size<V>();
+  if (n <= block) {
+    if constexpr (fast) simd_plus::exclusive_scan(std::to_address(first), n, std::to_address(out), init);
+    else std::exclusive_scan(first, last, out, init, op);
+    return out + n;
+  }
+  blocked_scan<InIt, T, fast>(first, n, block, op, [&](size_t b, const T* carry) {
+    auto begin = first + b * block;
+    auto end = first + std::min(n, (b + 1) * block);
+    const T start = carry ? op(init, *carry) : init;
+    if constexpr (fast)
+      simd_plus::exclusive_scan(std::to_address(begin), end - begin, std::to_address(out + b * block), start);
+    else std::exclusive_scan(begin, end, out + b * block, start, op);
+  });
+  return out + n;
+}
+
+template <typename... Fs>
+inline void parallel_invoke(Fs&&... fs) {
+  static_assert((std::is_invocable_v<Fs&> && ...));
+  with_scheduler([&](scheduler_type& scheduler) {
+    fork_join_scheduler::invoke(scheduler, std::forward<Fs>(fs)...);
+  });
+}
+
+// Side of a square tile of elem_bytes sized elements such that tiles
+// of them, e.g. 3 for the operands of a matrix product, fit in the
+// cache at level together.
+inline size_t cache_tile_side(size_t elem_bytes, size_t tiles = 1, int level = 2) {
+  static const size_t l1 = cpu_topology::cache_size(1, 32 << 10);
+  static const size_t l2 = cpu_topology::cache_size(2, 1 << 20);
+  const size_t bytes = level == 1 ? l1 : l2;
+  size_t side = 1;
+  while ((side + 1) * (side + 1) * elem_bytes * tiles <= bytes) ++side;
+  return side;
+}
+
+template <typename F>
+inline void parallel_for_2d(size_t row_begin, size_t row_end, size_t col_begin, size_t col_end,
+                            F&& f, size_t grain, bool conservative) {
+  static_assert(std::is_invocable_v<F&, const tbb::blocked_range2d<size_t>&>);
+  if (row_end <= row_begin || col_end <= col_begin) return;
+  if (grain == 0) grain = cache_tile_side(sizeof(double), 3);
+  tbb::blocked_range2d<size_t> range(row_begin, row_end, grain, col_begin, col_end, grain);
+  with_scheduler([&](scheduler_type& scheduler) {
+    fork_join_scheduler::parfor_tiles(scheduler, range, f, conservative);
+  });
+}
+
+template <typename F>
+inline void parallel_for_3d(size_t page_begin, size_t page_end, size_t row_begin, size_t row_end,
+                            size_t col_begin, size_t col_end, F&& f, size_t grain, bool conservative) {
+  static_assert(std::is_invocable_v<F&, const tbb::blocked_range3d<size_t>&>);
+  if (page_end <= page_begin || row_end <= row_begin || col_end <= col_begin) return;
+  if (grain == 0) grain = cache_tile_side(sizeof(double), 3);
+  tbb::blocked_range3d<size_t> range(page_begin, page_end, grain, row_begin, row_end, grain,
+                                     col_begin, col_end, grain);
+  with_scheduler([&](scheduler_type& scheduler) {
+    fork_join_scheduler::parfor_tiles(scheduler, range, f, conservative);
+  });
+}
+
 template <typename Lf, typename Rf>
 inline void par_do(Lf&& left, Rf&& right, bool conservative) {
   static_assert(std::is_invocable_v<Lf&&>);
   static_assert(std::is_invocable_v<Rf&&>);
-  fork_join_scheduler::pardo(get_current_scheduler(), std::forward<Lf>(left), std::forward<Rf>(right), conservative);
+  with_scheduler([&](scheduler_type& scheduler) {
+    fork_join_scheduler::pardo(scheduler, std::forward<Lf>(left), std::forward<Rf>(right), conservative);
+  });
   //::usleep(2);
 }
 
+// Like parallel_do, but the right side only becomes a task if a
+// heartbeat promotes it while left runs.
+template <typename Lf, typename Rf>
+inline void heartbeat_do(Lf&& left, Rf&& right, bool conservative) {
+  static_assert(std::is_invocable_v<Lf&&>);
+  static_assert(std::is_invocable_v<Rf&&>);
+  with_scheduler([&](scheduler_type&) {
+    fork_join_scheduler::heartbeat_pardo(std::forward<Lf>(left), std::forward<Rf>(right), conservative);
+  });
+}
+
 template <typename F>
 void execute_with_scheduler(unsigned int p, F&& f) {
   scheduler_type scheduler(p);
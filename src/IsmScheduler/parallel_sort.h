@@ -0,0 +1,159 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdint>
+
+#include <algorithm>
+#include <functional>
+#include <iterator>
+#include <memory>
+#include <random>
+#include <utility>
+#include <vector>
+
+#include "parallel_for.h"
+
+// Samplesort on the ISM scheduler.
+//
+// A sorted random sample picks up to max_splitters splitters. Elements
+// equal to a splitter get a bucket of their own, so long runs of equal
+// keys need no further sorting and can not make the recursion stall.
+// The input is cut into blocks, and three parallel passes follow:
+//   1. every block classifies its elements, keeping the bucket of each
+//      in a side array, and counts them per bucket,
+//   2. every block moves its elements to their bucket's slice of a
+//      buffer, at offsets from a scan of the counts,
+//   3. every bucket is moved back and sorted, by std::sort or, if the
+//      sample was unlucky and the bucket came out large, recursively.
+// Input that is already sorted is detected by a parallel check first.
+// The value type has to be default constructible for the buffer.
+
+namespace samplesort {
+
+// Ranges up to this many elements go to std::sort.
+constexpr std::size_t serial_threshold = 1 << 14;
+constexpr std::size_t max_splitters = 255;
+constexpr std::size_t oversampling = 16;
+// Blocks per worker in the classification and scatter passes.
+constexpr std::size_t blocks_per_worker = 4;
+
+using bucket_id = std::uint16_t;
+static_assert(2 * max_splitters + 1 <= UINT16_MAX);
+
+// std::lower_bound without the unpredictable branch, the comparison only
+// selects the next base.
+template <typename T, typename Compare>
+std::size_t lower_bound(const std::vector<T>& splitters, const T& x, Compare& comp) {
+  const T* base = splitters.data();
+  std::size_t len = splitters.size();
+  while (len > 1) {
+    std::size_t half = len / 2;
+    base += static_cast<std::size_t>(static_cast<bool>(comp(base[half - 1], x))) * half;
+    len -= half;
+  }
+  return (base - splitters.data()) + (len == 1 && comp(*base, x));
+}
+
+template <typename RandomIt, typename Compare>
+bool is_sorted(RandomIt first, std::size_t n, Compare& comp) {
+  // Every chunk also checks its border with the next one.
+  return parallel_reduce_morsel(0, n - 1, true,
+      [&](tbb::blocked_range<std::size_t> r, bool sorted) {
+        if (!sorted) return false;
+        for (std::size_t i = r.begin(); i != r.end(); ++i)
+          if (comp(first[i + 1], first[i])) return false;
+        return true;
+      },
+      std::logical_and<bool>());
+}
+
+template <typename RandomIt, typename Compare>
+void sample_sort(RandomIt first, RandomIt last, Compare& comp) {
+  using T = typename std::iterator_traits<RandomIt>::value_type;
+  const std::size_t n = last - first;
+  if (n <= serial_threshold) {
+    std::sort(first, last, comp);
+    return;
+  }
+  if (is_sorted(first, n, comp)) return;
+
+  // Splitters, sorted and without duplicates.
+  const std::size_t k = std::min(max_splitters, n / serial_threshold);
+  std::vector<T> sample;
+  sample.reserve(k * oversampling);
+  std::mt19937_64 gen(n);
+  for (std::size_t i = 0; i < k * oversampling; ++i) sample.push_back(first[gen() % n]);
+  std::sort(sample.begin(), sample.end(), comp);
+  std::vector<T> splitters;
+  for (std::size_t i = 1; i <= k; ++i) {
+    const T& s = sample[i * sample.size() / (k + 1)];
+    if (splitters.empty() || comp(splitters.back(), s)) splitters.push_back(s);
+  }
+  // Bucket 2i holds the elements between splitters i - 1 and i, bucket
+  // 2i + 1 the ones equal to splitter i.
+  const std::size_t num_buckets = 2 * splitters.size() + 1;
+  auto classify = [&](const T& x) -> bucket_id {
+    std::size_t i = lower_bound(splitters, x, comp);
+    return static_cast<bucket_id>(i < splitters.size() && !comp(x, splitters[i]) ? 2 * i + 1 : 2 * i);
+  };
+
+  const std::size_t num_blocks = std::clamp<std::size_t>(
+      num_workers() * blocks_per_worker, 1, n / serial_threshold);
+  const std::size_t block = (n + num_blocks - 1) / num_blocks;
+  std::unique_ptr<bucket_id[]> ids(new bucket_id[n]);
+  // counts[b * num_buckets + j] is the number of elements of block b in
+  // bucket j, and becomes where block b writes its first one.
+  std::vector<std::size_t> counts(num_blocks * num_buckets, 0);
+  parallel_for(0, num_blocks, [&](std::size_t b) {
+    std::size_t* count = &counts[b * num_buckets];
+    for (std::size_t i = b * block; i < std::min(n, (b + 1) * block); ++i) {
+      bucket_id j = classify(first[i]);
+      ids[i] = j;
+      ++count[j];
+    }
+  }, 1);
+
+  // Bucket major, so every bucket is contiguous in the buffer.
+  std::vector<std::size_t> bucket_start(num_buckets + 1);
+  std::size_t offset = 0;
+  for (std::size_t j = 0; j < num_buckets; ++j) {
+    bucket_start[j] = offset;
+    for (std::size_t b = 0; b < num_blocks; ++b) {
+      std::size_t c = counts[b * num_buckets + j];
+      counts[b * num_buckets + j] = offset;
+      offset += c;
+    }
+  }
+  bucket_start[num_buckets] = n;
+  assert(offset == n);
+
+  // Default initialised, every element is written before it is read.
+  std::unique_ptr<T[]> buffer(new T[n]);
+  parallel_for(0, num_blocks, [&](std::size_t b) {
+    std::size_t* next = &counts[b * num_buckets];
+    for (std::size_t i = b * block; i < std::min(n, (b + 1) * block); ++i)
+      buffer[next[ids[i]]++] = std::move(first[i]);
+  }, 1);
+  ids.reset();
+
+  // An even share of a bucket is n / (k + 1), recursion only pays off for
+  // buckets well above that.
+  const std::size_t recurse_above = std::max(serial_threshold, 4 * n / (k + 1));
+  parallel_for(0, num_buckets, [&](std::size_t j) {
+    auto begin = buffer.get() + bucket_start[j];
+    auto end = buffer.get() + bucket_start[j + 1];
+    auto out = first + bucket_start[j];
+    std::move(begin, end, out);
+    if (j % 2 == 1) return;  // all equal
+    auto out_end = first + bucket_start[j + 1];
+    if (static_cast<std::size_t>(out_end - out) > recurse_above) sample_sort(out, out_end, comp);
+    else std::sort(out, out_end, comp);
+  }, 1);
+}
+
+}  // namespace samplesort
+
+template <typename RandomIt, typename Compare = std::less<>>
+inline void parallel_sort(RandomIt first, RandomIt last, Compare comp = Compare()) {
+  samplesort::sample_sort(first, last, comp);
+}
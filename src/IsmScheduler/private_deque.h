@@ -0,0 +1,194 @@
+#pragma once
+#include <atomic>
+#include <cassert>
+#include <limits>
+#include <utility>
+
+#include "split_deque.h"
+
+// Private/public split deque after LCWS (deque_variants/private.cpp),
+// with the same interface as Deque so scheduler_ism can use either.
+//
+// Slots [top, pub) are public and work like the ABP deque, slots
+// [pub, bot) are private to the owner, who pushes and pops them
+// without any fence or CAS. A thief that finds the public part empty
+// while private work exists sets targeted. Instead of being signalled,
+// the owner polls the flag whenever it pushes or pops and then moves
+// its oldest private job into the public part.
+//
+// The owner only synchronises once its private part is empty and it
+// has to take back a job it exposed earlier.
+
+template <typename Job>
+struct PrivateDeque : chunked_slots<Job> {
+  using qidx = unsigned int;
+  using tag_t = unsigned int;
+  using chunked_slots<Job>::slot;
+  using chunked_slots<Job>::reserve;
+
+  struct alignas(int64_t) age_t {
+    tag_t tag;
+    qidx top;
+  };
+
+  // bot is written on every owner push and pop but only read by thieves
+  // that found the public part empty, keep it away from pub and age.
+  alignas(64) std::atomic<qidx> bot;
+  alignas(64) std::atomic<qidx> pub;
+  std::atomic<bool> targeted;
+  alignas(64) std::atomic<age_t> age;
+
+#ifdef profiling_stats
+  int pushBottom, popBottom, popTop, success, exposed;
+  long long cas, fence;
+#endif //profiling_stats
+
+  PrivateDeque() : bot(0), pub(0), targeted(false), age(age_t{0, 0})
+#ifdef profiling_stats
+            , pushBottom(0), popBottom(0), popTop(0), success(0), exposed(0), cas(0), fence(0)
+#endif
+            {}
+
+  // Public and private jobs, exact only for the owner.
+  int size() const {
+    auto local_bot = bot.load(std::memory_order_acquire);
+    auto local_top = age.load(std::memory_order_acquire).top;
+    return local_bot > local_top ? local_bot - local_top : 0;
+  }
+
+  // Adds a job to the private part. Only the owning thread may call this.
+  //
+  // Returns false, leaving the queue unchanged, if the queue is full and
+  // can not grow.
+  bool push_bottom(Job* job) {
+    auto local_bot = bot.load(std::memory_order_relaxed);
+    if (local_bot == std::numeric_limits<qidx>::max() || !reserve(local_bot)) return false;
+    slot(local_bot).store(job, std::memory_order_relaxed);
+    bot.store(local_bot + 1, std::memory_order_relaxed);
+#ifdef profiling_stats
+    pushBottom++;
+#endif
+    poll();
+    return true;
+  }
+
+  // Adds jobs[0], ..., jobs[n - 1] to the private part, jobs[n - 1] at
+  // the bottom. Only the owning thread may call this.
+  //
+  // Returns false, leaving the queue unchanged, if they do not all fit.
+  bool push_bottom_bulk(Job* const* jobs, size_t n) {
+    auto local_bot = bot.load(std::memory_order_relaxed);
+    if (n > std::numeric_limits<qidx>::max() - local_bot) return false;
+    for (size_t i = 0; i < n; ++i)
+      if (!reserve(local_bot + i)) return false;
+    for (size_t i = 0; i < n; ++i) slot(local_bot + i).store(jobs[i], std::memory_order_relaxed);
+    bot.store(local_bot + n, std::memory_order_relaxed);
+#ifdef profiling_stats
+    pushBottom += n;
+#endif
+    poll();
+    return true;
+  }
+
+  // Pops the bottom job, from the private part if possible. Only the
+  // owning thread may call this.
+  Job* pop_bottom() {
+    poll();
+#ifdef profiling_stats
+    popBottom++;
+#endif
+    auto local_bot = bot.load(std::memory_order_relaxed);
+    if (local_bot > pub.load(std::memory_order_relaxed)) {
+      local_bot--;
+      bot.store(local_bot, std::memory_order_relaxed);
+      return slot(local_bot).load(std::memory_order_relaxed);
+    }
+    return pop_public_bottom();
+  }
+
+  // Steals the top job of the public part. Threads other than the owner
+  // can use this function.
+  //
+  // Returns {job, empty} like Deque::pop_top. If only the private part
+  // holds work, asks the owner to expose some and returns {nullptr, false}.
+  std::pair<Job*, bool> pop_top() {
+    auto old_age = age.load(std::memory_order_acquire);
+    auto local_pub = pub.load(std::memory_order_acquire);
+#ifdef profiling_stats
+    popTop++;
+#endif
+
+    if (local_pub > old_age.top) {
+      auto job = slot(old_age.top).load(std::memory_order_acquire);
+      auto new_age = old_age;
+      new_age.top = new_age.top + 1;
+#ifdef profiling_stats
+      cas++;
+#endif
+      if (age.compare_exchange_strong(old_age, new_age)) {
+#ifdef profiling_stats
+        success++;
+#endif
+        return {job, (local_pub == old_age.top + 1)};
+      }
+      return {nullptr, (local_pub == old_age.top + 1)};
+    }
+    if (bot.load(std::memory_order_relaxed) > local_pub) {
+      if (!targeted.load(std::memory_order_relaxed))
+        targeted.store(true, std::memory_order_relaxed);
+      return {nullptr, false};
+    }
+    return {nullptr, true};
+  }
+
+ private:
+  // Moves the oldest private job into the public part if a thief asked.
+  void poll() {
+    if (!targeted.load(std::memory_order_relaxed)) return;
+    targeted.store(false, std::memory_order_relaxed);
+    auto local_pub = pub.load(std::memory_order_relaxed);
+    if (local_pub < bot.load(std::memory_order_relaxed)) {
+      // Publishes the slot written by push_bottom.
+      pub.store(local_pub + 1, std::memory_order_release);
+#ifdef profiling_stats
+      exposed++;
+#endif
+    }
+  }
+
+  // The private part is empty, take back the bottom public job as
+  // Deque::pop_bottom does.
+  Job* pop_public_bottom() {
+    Job* result = nullptr;
+    auto local_pub = pub.load(std::memory_order_relaxed);
+    if (local_pub != 0) {
+      local_pub--;
+      pub.store(local_pub, std::memory_order_release);
+      bot.store(local_pub, std::memory_order_relaxed);
+      std::atomic_thread_fence(std::memory_order_seq_cst);
+      auto job = slot(local_pub).load(std::memory_order_acquire);
+      auto old_age = age.load(std::memory_order_acquire);
+#ifdef profiling_stats
+      fence++;
+#endif
+      if (local_pub > old_age.top)
+        result = job;
+      else {
+        pub.store(0, std::memory_order_release);
+        bot.store(0, std::memory_order_relaxed);
+        auto new_age = age_t{old_age.tag + 1, 0};
+        if ((local_pub == old_age.top) &&
+            age.compare_exchange_strong(old_age, new_age))
+          result = job;
+        else {
+          age.store(new_age, std::memory_order_seq_cst);
+          result = nullptr;
+        }
+#ifdef profiling_stats
+        cas++;
+#endif
+      }
+    }
+    return result;
+  }
+};
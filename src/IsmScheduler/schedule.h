@@ -7,12 +7,18 @@
 #include <cstdlib>
 
 #include <algorithm>
+#include <array>
 #include <atomic>
 #include <chrono>         // IWYU pragma: keep
+#include <functional>
 #include <iostream>
 #include <memory>
 #include <numeric>
+#include <optional>
+#include <stdexcept>
 #include <oneapi/tbb/blocked_range.h>
+#include <oneapi/tbb/blocked_range2d.h>
+#include <oneapi/tbb/blocked_range3d.h>
 #include <thread>
 #include <type_traits>    // IWYU pragma: keep
 #include <unistd.h>
@@ -24,15 +30,106 @@
 #include "split_deque.h"         // IWYU pragma: keep
 #include "job.h"
 #include "mailbox.h"
-#include <oneapi/tbb/detail/_small_object_pool.h>
+#include "injection_queue.h"
+#include "topology.h"
+#include "allocator/small_obj_pool.h"
 
 #define TIMEOUT 10000
 
+// True if idle workers should go to sleep after failing to steal for
+// PARLAY_ELASTIC_STEAL_TIMEOUT microseconds, as in scheduler_ohne.h.
+// Sleeping workers are woken when new work is pushed, and a worker that
+// is mailed a task is woken directly.
+//
+// Default: false
+#ifndef PARLAY_ELASTIC_PARALLELISM
+#define PARLAY_ELASTIC_PARALLELISM false
+#endif
+
+#ifndef PARLAY_ELASTIC_STEAL_TIMEOUT
+#define PARLAY_ELASTIC_STEAL_TIMEOUT TIMEOUT
+#endif
+
+#if PARLAY_ELASTIC_PARALLELISM
+#include "atomic_wait.h"
+#endif
+
+// True if workers should use the private/public split deque of
+// private_deque.h, where pushes and pops of the owner need no fence or
+// CAS and work is exposed to thieves only on request.
+//
+// Default: false
+#ifndef ISM_PRIVATE_DEQUE
+#define ISM_PRIVATE_DEQUE false
+#endif
+
+// True if parfor should use lazy binary splitting: a worker runs its
+// range chunk by chunk and splits off half of what is left only when
+// its own deque is empty or some worker is idle, instead of spawning
+// one task per chunk up front.
+//
+// Default: true
+#ifndef ISM_LAZY_SPLITTING
+#define ISM_LAZY_SPLITTING true
+#endif
+
+// Heartbeat period in microseconds for heartbeat_pardo. A worker
+// promotes at most one latent right branch into a real task per period,
+// which bounds the task creation overhead for arbitrarily fine-grained
+// parallel_do.
+#ifndef ISM_HEARTBEAT_US
+#define ISM_HEARTBEAT_US 100
+#endif
+
+// Random victims a topology-aware thief tries in each tier, at most as
+// many as the tier has, before it moves on to the next farther one. A
+// failed steal from a close victim is a few cache misses on a shared
+// cache, one from a remote socket crosses the interconnect. So the
+// thief should fail a few times close by before it goes remote.
+//
+// Default: 2
+#ifndef ISM_STEAL_TIER_ATTEMPTS
+#define ISM_STEAL_TIER_ATTEMPTS 2
+#endif
+
+// Workers that are not pinned to a cpu note the cpu they are on when
+// they start stealing. They re-sort their steal tiers by the cpus the
+// others were last seen on every ISM_TIER_REFRESH times, and right away
+// when they find themselves on another cpu.
+//
+// Default: 64
+#ifndef ISM_TIER_REFRESH
+#define ISM_TIER_REFRESH 64
+#endif
+
+#if ISM_PRIVATE_DEQUE
+#include "private_deque.h"
+template <typename Job>
+using ism_deque = PrivateDeque<Job>;
+#else
+template <typename Job>
+using ism_deque = Deque<Job>;
+#endif
+
 
 
 #define DEBUG1 0
 #define DEBUG_2 1
 
+// How pardo picks the worker whose mailbox receives the right task.
+//
+// random: a uniformly random worker.
+// local:  the closest worker (SMT sibling, then last level cache, then
+//         socket) whose mailbox is empty, spreading to remote sockets
+//         only once every closer mailbox is occupied. Unpinned workers
+//         are placed by the cpu they were last seen on, see
+//         ISM_TIER_REFRESH.
+enum class mailbox_policy { random, local };
+
+#ifndef ISM_MAILBOX_POLICY
+#define ISM_MAILBOX_POLICY mailbox_policy::local
+#endif
+
 
 template <typename Job>
 struct scheduler_ism{
@@ -76,10 +173,12 @@ struct scheduler_ism{
 
   // The length of time that a worker must fail to steal anything
   // before it goes to sleep to save CPU time.
-  constexpr static std::chrono::microseconds STEAL_TIMEOUT{TIMEOUT};
+  constexpr static std::chrono::microseconds STEAL_TIMEOUT{PARLAY_ELASTIC_STEAL_TIMEOUT};
 
   static inline thread_local workerInfo worker_info{};
 
+  static constexpr worker_id_type no_worker = std::numeric_limits<worker_id_type>::max();
+
 
   
   size_t hash(uint64_t x) {
@@ -98,37 +197,85 @@ struct scheduler_ism{
   static scheduler_ism* get_current_scheduler() {
     return worker_info.my_scheduler;
   }
-  tbb::detail::d1::small_object_allocator allocator;
-  explicit scheduler_ism(size_t num_workers)
+  small_object_pool& local_pool() { return pools[worker_id()]; }
+
+  // If numa_aware, idle workers steal from their SMT siblings first, then
+  // from workers sharing their last level cache or socket, and only then
+  // from remote sockets. Otherwise victims are picked uniformly at random.
+  //
+  // pin places worker i, the calling thread being worker 0, on the i-th
+  // cpu in the order of its policy, so that neighbouring ids share
+  // caches. The caller gets its affinity back when the scheduler goes.
+  // Unless given, it comes from the ISM_PIN environment variable.
+  explicit scheduler_ism(size_t num_workers, bool numa_aware = true, const pinning& pin = pinning::from_env())
+      : scheduler_ism(num_workers, 0, true, numa_aware, pin) {}
+
+  // Selects the constructor of a scheduler that no thread belongs to. All
+  // of its workers are spawned, and up to external_slots other threads at
+  // a time run work in it through execute.
+  struct shared_t {
+    size_t external_slots;
+  };
+
+  scheduler_ism(shared_t shared, size_t num_workers, bool numa_aware = true,
+                const pinning& pin = pinning::from_env())
+      : scheduler_ism(num_workers, shared.external_slots, false, numa_aware, pin) {}
+
+ private:
+  scheduler_ism(size_t num_workers, size_t external_slots, bool caller_is_worker, bool numa_aware,
+                const pinning& pin)
       : num_threads(num_workers),
-        num_deques(num_threads),
+        num_deques(num_threads + external_slots),
         num_awake_workers(num_threads),
-        deques(num_threads),
+        sleepers(num_threads + external_slots),
+        deques(num_threads + external_slots),
         attempts(num_deques),
         spawned_threads(),
         finished_flag(false),
         can_steal(false),
-        mail_inboxes(num_workers),
-        mail_outboxes(num_workers),
-        parent_worker_info(std::exchange(worker_info, workerInfo{0,this})),
-        num_of_tasks(num_workers),
-        senders(num_workers)
+        mail_inboxes(num_threads + external_slots),
+        mail_outboxes(num_threads + external_slots),
+        parent_worker_info(caller_is_worker ? std::exchange(worker_info, workerInfo{0,this}) : workerInfo{}),
+        num_of_tasks(num_threads + external_slots),
+        senders(num_threads + external_slots),
+        first_spawned(caller_is_worker ? 1 : 0),
+        slot_taken(external_slots),
+        numa_aware(numa_aware),
+        placement(pin.policy),
+        topology(place(cpu_topology::discover(), pin)),
+        num_pinned(pins_each_worker(pin.policy) ? num_threads : 0),
+        cpu_index(topology.index_by_id()),
+        seen_cpus(num_deques),
+        victim_tiers(steal_tiers<worker_id_type>::build(topology, num_deques, num_pinned)),
+        pools(new small_object_pool[num_threads + external_slots])
   {
     
-    for(auto i = 0; i < num_workers; ++i){
+    for(auto i = 0; i < num_deques; ++i){
       mail_outboxes[i] = new mail_outbox();
       mail_outboxes[i]->construct();
       mail_inboxes[i] = new mail_inbox();  
       mail_inboxes[i]->attach(*mail_outboxes[i]);
     }
-    for (worker_id_type i = 1; i < num_threads; ++i) {
-      spawned_threads.emplace_back([&, i]() { worker_info = {i, this}; worker(); });
+    if (placement != pin_policy::none && caller_is_worker) {
+      sched_getaffinity(0, sizeof(parent_affinity), &parent_affinity);
+      bind_worker(0);
+    }
+    for (worker_id_type i = first_spawned; i < num_threads; ++i) {
+      spawned_threads.emplace_back([&, i]() {
+        worker_info = {i, this};
+        bind_worker(i);
+        worker();
+      });
     }
   }
 
+ public:
   ~scheduler_ism() {
     shutdown();
-    worker_info = std::move(parent_worker_info); 
+    if (first_spawned == 1) {
+      worker_info = std::move(parent_worker_info);
+      if (placement != pin_policy::none) sched_setaffinity(0, sizeof(parent_affinity), &parent_affinity);
+    }
     #ifdef profiling_stats
     
     long long total_cas = 0;
@@ -139,6 +286,12 @@ struct scheduler_ism{
     long long total_popTop = 0;
     long long total_insert = 0;
     long long total_mailbox_cas = 0; 
+    long long total_local_steals = 0;
+    long long total_remote_steals = 0;
+    long long total_unknown_steals = 0;
+    long long total_local_allocs = 0;
+    long long total_remote_allocs = 0;
+    long long total_remote_frees = 0;
     for (const auto& deque : deques) {  // Assuming you have a way to get access to the deques
         total_cas += deque.cas;
         total_fence += deque.fence;
@@ -152,6 +305,17 @@ struct scheduler_ism{
       total_extract += mailbox->extract;
       total_insert += mailbox->insert;
     }
+    for (const auto& a : attempts) {
+      total_local_steals += a.local_steals;
+      total_remote_steals += a.remote_steals;
+      total_unknown_steals += a.unknown_steals;
+    }
+    // Guests allocate from the pools of their external slots.
+    for (int i = 0; i < num_deques; ++i) {
+      total_local_allocs += pools[i].local_allocs;
+      total_remote_allocs += pools[i].remote_allocs;
+      total_remote_frees += pools[i].remote_frees;
+    }
     std::cout << "Profiling stats:" << std::endl;
     std::cout << "CAS operations:   " << total_cas << std::endl;
     std::cout << "Fence operations: " << total_fence << std::endl;
@@ -161,59 +325,192 @@ struct scheduler_ism{
     std::cout << "mailbox insert:   " << total_insert<< std::endl;
     std::cout << "mailbox extract   " << total_extract<< std::endl;
     std::cout << "mailbox cas       " << total_mailbox_cas<< std::endl;
+    std::cout << "local steals      " << total_local_steals << std::endl;
+    std::cout << "remote steals     " << total_remote_steals << std::endl;
+    std::cout << "unknown steals    " << total_unknown_steals << std::endl;
+    std::cout << "local/remote      ";
+    if (total_remote_steals) std::cout << double(total_local_steals) / total_remote_steals << std::endl;
+    else std::cout << "n/a" << std::endl;
+    std::cout << "local allocs      " << total_local_allocs << std::endl;
+    std::cout << "remote allocs     " << total_remote_allocs << std::endl;
+    std::cout << "remote frees      " << total_remote_frees << std::endl;
 
 
     
 #endif
   }
 
+  // Runs f on the calling thread as a guest in one of the external
+  // slots, where f can spawn and join like on a worker, and the thread
+  // helps with other work while it waits at a join. Threads of this
+  // scheduler just run f. If every slot is taken the caller waits for
+  // one. Throws std::logic_error on a scheduler without slots, that is
+  // one not constructed with shared_t or with no external slots.
+  template <typename F>
+  decltype(auto) execute(F&& f) {
+    if (worker_info.my_scheduler == this) return std::invoke(std::forward<F>(f));
+    if (slot_taken.empty()) throw std::logic_error("scheduler_ism::execute: no external slots");
+    guest_scope guest(*this);
+    return std::invoke(std::forward<F>(f));
+  }
+
+  // Queues f for the workers from any thread, worker or not, and returns
+  // a handle to wait on. Idle workers poll the queue before they steal,
+  // busy ones get to it when they run out of work. Jobs still queued
+  // when the scheduler is destroyed never run.
+  template <typename F>
+  submit_handle submit(F&& f) {
+    static_assert(std::is_invocable_v<std::decay_t<F>&>);
+    auto* job = new injected_job<std::decay_t<F>>(std::forward<F>(f));
+    submit_handle handle(job);
+    injected.push(job);
+#if PARLAY_ELASTIC_PARALLELISM
+    wake_up_a_worker();
+#endif
+    return handle;
+  }
+
   // Push onto local stack.
-  void spawn(Job* job) {
-    int id = worker_id();
-    //if(deques[id].size() > 9990)
-    //felicity::safe_cout << "The deque is " << deques[id].size() << " ,id: " << id<<   "\n";
+  //
+  // Returns false if the local stack is full and can not grow, in which
+  // case the caller has to run the job itself.
+  bool spawn(Job* job) {
+    if (!push_local(job)) return false;
+#if PARLAY_ELASTIC_PARALLELISM
+    wake_up_a_worker();
+#endif
+    return true;
+  }
+
+  // Push job onto the local stack, and if some worker is idle also mail
+  // it a proxy so that it does not have to find the job by stealing.
+  // When nobody is idle the job goes to the deque only, which saves the
+  // proxy allocation and the two extraction CASes.
+  //
+  // Returns false, like spawn, if the job could not be pushed.
+  bool spawn_mailed(Job* job) {
+    const auto target_id = get_spawn_id_mailbox();
+    if (target_id == no_worker) return spawn(job);
+    task_proxy* proxy = local_pool().template new_object<task_proxy>();
+    proxy->task_and_tag = (intptr_t)(job) | task_proxy::location_mask;
+    proxy->outbox = mail_outboxes[target_id];
+    proxy->slot = target_id;
+    // Push to the deque first, the mailbox copy can not be taken back.
+    if (!push_local(proxy)) {
+      local_pool().delete_object(proxy);
+      return false;
+    }
+    proxy->outbox->push(proxy);
+#if PARLAY_ELASTIC_PARALLELISM
+    // The recipient may be asleep, wake exactly that worker.
+    wake_up_worker(target_id);
+#endif
+    return true;
+  }
+
+  // Pushes several jobs onto the local stack at once, jobs[n - 1] at the
+  // bottom. No proxies are mailed, idle workers steal them.
+  //
+  // Returns false, like spawn, if they could not all be pushed.
+  bool spawn_bulk(Job* const* jobs, size_t n) {
+    if (!deques[worker_id()].push_bottom_bulk(jobs, n)) return false;
+#if PARLAY_ELASTIC_PARALLELISM
+    wake_up_a_worker();
+#endif
+    return true;
+  }
+
+  // Join of spawn_bulk with the same jobs. Runs those that nobody stole
+  // here, bottom first. As for try_reclaim, thieves take from the top,
+  // so once a pop comes back empty the rest have been stolen, and an
+  // entry that is not one of jobs is pushed back. The caller waits for
+  // whatever did not run here.
+  void reclaim_bulk(Job* const* jobs, size_t n) {
+    auto& deque = deques[worker_id()];
+    for (size_t i = 0; i < n; ++i) {
+      Job* job = deque.pop_bottom();
+      if (!job) return;
+      if (std::find(jobs, jobs + n, job) == jobs + n) {
+        [[maybe_unused]] bool pushed = deque.push_bottom(job);
+        assert(pushed);
+        return;
+      }
+      (*job)();
+    }
+  }
 
-    [[maybe_unused]] bool first = deques[id].push_bottom(job);
+  // Fast join for pardo and the coroutine joins. Takes job back from
+  // the bottom of the own deque if neither a thief nor the mailbox
+  // recipient claimed it, in which case the caller runs it inline. A
+  // plain job costs only the pop, a proxy one extraction CAS against the
+  // recipient.
+  //
+  // The bottom entry is not necessarily job or its proxy: task graph
+  // nodes and resumed coroutines spawn work that no join takes back, and
+  // a join that stole while it waited may have run them. Anything else
+  // is pushed back, and the caller waits for job instead.
+  bool try_reclaim(Job* job) {
+    auto& deque = deques[worker_id()];
+    Job* popped = deque.pop_bottom();
+    // Thieves take from the top, so if job was stolen the deque is empty.
+    if (!popped) return false;
+    if (popped == job) return true;
+    task_proxy* proxy = task_proxy::from(popped);
+    if (!proxy || task_proxy::task_ptr(proxy->task_and_tag.load(std::memory_order_acquire)) != job) {
+      // The slot was just freed, pushing into it again can not fail.
+      [[maybe_unused]] bool pushed = deque.push_bottom(popped);
+      assert(pushed);
+      return false;
+    }
+    if (proxy->extract_task<task_proxy::pool_bit>()) return true;
+    // The recipient runs the job, and we are the second to touch the proxy.
+    local_pool().delete_object(proxy);
+    return false;
+  }
 
+  // Workers publish that they ran out of own work in their outbox, and
+  // num_idle_workers lets spawners skip the scan when nobody is idle.
+  void set_idle(worker_id_type id, bool idle) {
+    mail_inboxes[id]->set_is_idle(idle);
+    if (idle) num_idle_workers.fetch_add(1, std::memory_order_relaxed);
+    else num_idle_workers.fetch_sub(1, std::memory_order_relaxed);
+  }
+
+  bool has_idle_workers() const {
+    return num_idle_workers.load(std::memory_order_relaxed) != 0;
+  }
+
+  // True if a loop should hand out part of its range: either nobody can
+  // steal from this worker because its deque is empty, or someone would.
+  bool wants_split() {
+    return deques[worker_id()].size() == 0 || has_idle_workers();
+  }
+
+  bool accepts_mail(worker_id_type target) {
+    return !senders[target] && mail_outboxes[target]->recipient_is_idle() && mail_outboxes[target]->empty();
   }
     
 
 
 
 
+  // If use_numa, the waiting worker steals topology-aware (see try_steal_tiered).
   template <typename F>
-  void wait_until(F&& done, bool conservative = false) {
+  void wait_until(F&& done, bool conservative = false, bool use_numa = true) {
     if (conservative) {
       while (!done())
         std::this_thread::yield();
     }
     else {
-      do_work_until(std::forward<F>(done));
+      do_work_until(std::forward<F>(done), use_numa && numa_aware);
     }
   }
 
+  // Mail first, then the own deque. The deque holds task proxies for
+  // jobs that were also mailed, and plain jobs otherwise.
   Job* get_own_job() {
     auto id = worker_id();
-    if(mail_inboxes[id]->empty()){
-      
-    //felicity::safe_cout << "my inbox is empty, id: " << id << "\n" 
-    //                 << "size of my deque: " << deques[id].size() << "\n\n";
-      while(auto* job = deques[id].pop_bottom()){
-        task_proxy* tmp = dynamic_cast<task_proxy*>(job);
-        if(tmp){
-          if(auto* result = tmp->extract_task<task_proxy::pool_bit>()){
-           // felicity::safe_cout << "extract_task Succesfully\n";
-          //std::cout << "DEQUE\n";
-            return result;
-          }
-
-        }
-        //felicity::safe_cout << "extract_task failed\n";
-        allocator.delete_object(tmp);
-      }
-      return nullptr;
-    }
-    else{
+    if(!mail_inboxes[id]->empty()){
      //felicity::safe_cout << "my inbox is not empty im using it, id: " << id << "\n"
       //                 << "size of my deque: " << deques[id].size() << "\n\n";
       while (task_proxy* const tp = mail_inboxes[id]->pop()) {
@@ -225,10 +522,23 @@ struct scheduler_ism{
         }
         // We have exclusive access to the proxy, and can destroy it.
         //felicity::safe_cout << "Aborted\n";
-        allocator.delete_object(tp); 
+        local_pool().delete_object(tp); 
       }
-      return nullptr;
-    } 
+    }
+    //felicity::safe_cout << "my inbox is empty, id: " << id << "\n" 
+    //                 << "size of my deque: " << deques[id].size() << "\n\n";
+    while(auto* job = deques[id].pop_bottom()){
+      task_proxy* tmp = task_proxy::from(job);
+      if(!tmp) return job;
+      if(auto* result = tmp->extract_task<task_proxy::pool_bit>()){
+       // felicity::safe_cout << "extract_task Succesfully\n";
+      //std::cout << "DEQUE\n";
+        return result;
+      }
+      //felicity::safe_cout << "extract_task failed\n";
+      local_pool().delete_object(tmp);
+    }
+    return nullptr;
   }
 
 
@@ -241,11 +551,43 @@ struct scheduler_ism{
  
 
   
+  void set_mailbox_policy(mailbox_policy policy) { mail_policy = policy; }
+
+  worker_id_type get_spawn_id_mailbox() {
+    switch (mail_policy) {
+      case mailbox_policy::local: return get_spawn_id_mailbox_local();
+      case mailbox_policy::random: break;
+    }
+    return get_spawn_id_mailbox_random();
+  }
+
+  // Both selectors only return idle workers with an empty mailbox, and
+  // no_worker if there is none.
+  worker_id_type get_spawn_id_mailbox_local() {
+    if (!has_idle_workers()) return no_worker;
+    const auto id = worker_id();
+    const auto& tiers = victim_tiers[id];
+    const size_t r = hash(id + 1) + hash(attempts[id].val++);
+    uint32_t begin = 0;
+    for (size_t level = 0; level < cpu_topology::num_levels; ++level) {
+      const uint32_t n = tiers.end[level] - begin;
+      for (uint32_t i = 0; i < n; ++i) {
+        const auto target = tiers.victims[begin + (r + i) % n];
+        if (accepts_mail(target)) return target;
+      }
+      begin = tiers.end[level];
+    }
+    return no_worker;
+  }
+
   worker_id_type get_spawn_id_mailbox_random() {
-        auto target_id = (hash(worker_id()+1) + hash(attempts[worker_id()].val++)+1) % (num_deques);
-        target_id = target_id == worker_id() ? (target_id + 1) % (num_threads) : target_id;
-        if(senders[target_id]) return get_spawn_id_mailbox_random();
-        else return target_id;
+        if (!has_idle_workers()) return no_worker;
+        auto start = (hash(worker_id()+1) + hash(attempts[worker_id()].val++)+1) % (num_deques);
+        for (worker_id_type i = 0; i < num_threads; ++i) {
+          auto target_id = (start + i) % num_threads;
+          if (target_id != worker_id() && accepts_mail(target_id)) return target_id;
+        }
+        return no_worker;
   }
 
 
@@ -253,7 +595,7 @@ struct scheduler_ism{
   std::vector<mail_inbox*> mail_inboxes; 
   int num_deques;
   
-  std::vector<Deque<Job>> deques;
+  std::vector<ism_deque<Job>> deques;
 
   std::vector<int> num_of_tasks;
   std::vector<int> senders;
@@ -261,8 +603,25 @@ private:
   // Align to avoid false sharing.
   struct alignas(128) attempt {
     size_t val;
+    // Steal rounds since the victim tiers were last sorted.
+    unsigned int tier_rounds = 0;
+#ifdef profiling_stats
+    // Steals from the same socket vs. from a remote one, and from
+    // workers whose cpu was not known yet.
+    long long local_steals = 0;
+    long long remote_steals = 0;
+    long long unknown_steals = 0;
+#endif
   };
   std::atomic<size_t> num_awake_workers;
+
+  // A sleeping worker waits on its own epoch, so that it can be woken
+  // individually when it is mailed a task.
+  struct alignas(128) sleeper {
+    std::atomic<int32_t> epoch{0};
+    std::atomic<bool> sleeping{false};
+  };
+  std::vector<sleeper> sleepers;
   workerInfo parent_worker_info;
    std::vector<attempt> attempts;
   std::vector<std::thread> spawned_threads;
@@ -270,13 +629,136 @@ private:
   std::atomic<int> can_steal;
   std::atomic<size_t> wake_up_counter{0};
   std::atomic<size_t> num_finished_workers{0};
+  alignas(128) std::atomic<size_t> num_idle_workers{0};
+
+  // 1 if the constructing thread is worker 0, 0 if every worker is spawned.
+  const worker_id_type first_spawned;
+  // External slot i, with worker id num_threads + i, is held by a thread
+  // inside execute.
+  std::vector<std::atomic<bool>> slot_taken;
+
+  // Jobs submitted from outside, see submit.
+  injection_queue injected;
+
+  const bool numa_aware;
+  mailbox_policy mail_policy = ISM_MAILBOX_POLICY;
+  const pin_policy placement;
+  cpu_set_t parent_affinity;
+  // cpus in placement order, worker i runs on cpu_of(i) if placement
+  // pins each worker.
+  const cpu_topology topology;
+  // Workers below num_pinned run on cpu_of, the others wherever the OS
+  // puts them.
+  const size_t num_pinned;
+  const std::vector<int> cpu_index;
+  // Where the unpinned ones were last seen, an index into topology.cpus
+  // or -1.
+  struct alignas(128) seen_cpu {
+    std::atomic<int> index{-1};
+  };
+  std::vector<seen_cpu> seen_cpus;
+  // Entry i is only touched by worker i.
+  std::vector<steal_tiers<worker_id_type>> victim_tiers;
+
+  // One pool per worker, task proxies are allocated from the pool of
+  // the spawning worker and freed into the pool of the extracting one.
+  std::unique_ptr<small_object_pool[]> pools;
+
+
+
+  // A job queued by submit. It is also its completion state, freed by
+  // whichever of job and handle lets go of it last.
+  struct injected_base : Job, injection_node, submit_state {
+    injected_base() : Job(job_kind::detached) {}
+  };
+
+  template <typename F>
+  struct injected_job : injected_base {
+    template <typename G>
+    explicit injected_job(G&& g) : f(std::forward<G>(g)) {}
+
+   protected:
+    void execute() override {
+      std::exception_ptr error;
+      try {
+        f();
+      } catch (...) {
+        error = std::current_exception();
+      }
+      this->finish(std::move(error));
+      this->release();
+    }
+
+   private:
+    F f;
+  };
+
+  Job* take_injected() {
+    injection_node* node = injected.try_pop();
+    return node ? static_cast<injected_base*>(node) : nullptr;
+  }
+
+  // Holds an external slot and makes the thread its worker for the
+  // lifetime of the scope.
+  struct guest_scope {
+    scheduler_ism& scheduler;
+    worker_id_type slot;
+    workerInfo outer;
+
+    explicit guest_scope(scheduler_ism& s)
+        : scheduler(s), slot(s.acquire_slot()), outer(std::exchange(worker_info, workerInfo{slot, &s})) {}
+
+    ~guest_scope() {
+      // The deque is empty after the last join, but tasks may have been
+      // mailed to the slot while it stole.
+      while (Job* job = scheduler.get_own_job()) (*job)();
+      worker_info = std::move(outer);
+      scheduler.slot_taken[slot - scheduler.num_threads].store(false, std::memory_order_release);
+    }
+  };
+
+  worker_id_type acquire_slot() {
+    const size_t n = slot_taken.size();
+    assert(n > 0);
+    const size_t start = hash(std::hash<std::thread::id>{}(std::this_thread::get_id())) % n;
+    while (true) {
+      for (size_t i = 0; i < n; ++i) {
+        auto& taken = slot_taken[(start + i) % n];
+        if (!taken.load(std::memory_order_relaxed) && !taken.exchange(true, std::memory_order_acquire))
+          return static_cast<worker_id_type>(num_threads + (start + i) % n);
+      }
+      std::this_thread::yield();
+    }
+  }
+
+  // A worker that can not be pinned, say because its cpu left the
+  // cpuset, runs wherever the OS puts it.
+  void bind_worker(worker_id_type id) {
+    if (placement != pin_policy::none) topology.bind(id, placement == pin_policy::cpuset);
+  }
 
+  bool push_local(Job* job) {
+    int id = worker_id();
+    //if(deques[id].size() > 9990)
+    //felicity::safe_cout << "The deque is " << deques[id].size() << " ,id: " << id<<   "\n";
 
+    return deques[id].push_bottom(job);
+  }
 
 void worker() {
+#if PARLAY_ELASTIC_PARALLELISM
+    wait_for_work();
+#endif
     while (!finished()) {
-      Job* job = get_job([&]() { return finished(); },false);
+      Job* job = get_job([&]() { return finished(); }, PARLAY_ELASTIC_PARALLELISM, numa_aware);
       if (job)(*job)();
+#if PARLAY_ELASTIC_PARALLELISM
+      else if (!finished()) {
+        // If no job was stolen, the worker should go to
+        // sleep and wait until more work is available
+        wait_for_work();
+      }
+#endif
     }
     assert(finished());
     num_finished_workers.fetch_add(1);
@@ -291,13 +773,13 @@ void worker() {
   // point to resume execution before the job it was waiting
   // on has completed.
   template <typename F>
-  void do_work_until(F&& done) {    
+  void do_work_until(F&& done, bool use_numa) {    
   #ifdef DEBUG 
     felicity::safe_cout << "[DBG]: Do work until has the id " << worker_id() << "\n";
     felicity::safe_cout << "[DBG]: The size of own work_deque is " << deques[worker_id()].size() << "\n";
   #endif
     while (true) {
-      Job* job = get_job(done, false);  // timeout MUST BE false
+      Job* job = get_job(done, false, use_numa);  // timeout MUST BE false
       if (!job) return;
       (*job)();
     }
@@ -305,7 +787,7 @@ void worker() {
   }
 
   template <typename F>
-  Job* get_job(F&& break_early, bool timeout) {
+  Job* get_job(F&& break_early, bool timeout, bool use_numa) {
     if (break_early()) return nullptr;
     Job* job = get_own_job();
     if (job) return job;
@@ -317,7 +799,9 @@ void worker() {
     //if(job) return job;
     else{
       //std::cout << "STEALING\n";
-      job = steal_job(std::forward<F>(break_early), timeout);
+      set_idle(worker_id(), true);
+      job = steal_job(std::forward<F>(break_early), timeout, use_numa);
+      set_idle(worker_id(), false);
     }
     return job;
   }
@@ -328,14 +812,19 @@ void worker() {
   // is found, or, if timeout is true and it takes longer than
   // STEAL_TIMEOUT to find a job to steal.
   template<typename F>
-  Job* steal_job(F&& break_early, bool timeout) {
+  Job* steal_job(F&& break_early, bool timeout, bool use_numa) {
     size_t id = worker_id();
+    if (use_numa) refresh_tiers(id);
     const auto start_time = std::chrono::steady_clock::now();
     do {
       // By coupon collector's problem, this should touch all.
       for (size_t i = 0; i <= YIELD_FACTOR * num_deques; i++) {
         if (break_early()) return nullptr;
-        Job* job = try_steal(id);
+        // Idle workers are mailed to, so check for mail between steals.
+        if (!mail_inboxes[id]->empty())
+          if (Job* job = get_own_job()) return job;
+        if (Job* job = take_injected()) return job;
+        Job* job = use_numa ? try_steal_tiered(id) : try_steal(id);
         if (job) return job;
       }
       std::this_thread::sleep_for(std::chrono::nanoseconds(num_deques * 100));
@@ -348,28 +837,159 @@ void worker() {
     size_t target = (hash(id) + hash(attempts[id].val)) % num_deques;
     //felicity::safe_cout << "trying to steal\n";
     attempts[id].val++;
+    return steal_from(target);
+  }
+
+  // Notes the cpu of an unpinned worker and re-sorts its victims, see
+  // ISM_TIER_REFRESH. sched_getcpu is a vDSO call, and the sort reads
+  // one line per worker.
+  void refresh_tiers(size_t id) {
+    if (num_pinned == static_cast<size_t>(num_deques)) return;
+    bool moved = false;
+    if (id >= num_pinned) {
+      const int c = sched_getcpu();
+      const int index = c >= 0 && c < CPU_SETSIZE ? cpu_index[c] : -1;
+      moved = seen_cpus[id].index.load(std::memory_order_relaxed) != index;
+      if (moved) seen_cpus[id].index.store(index, std::memory_order_relaxed);
+    }
+    auto& a = attempts[id];
+    if (!moved && ++a.tier_rounds < ISM_TIER_REFRESH) return;
+    a.tier_rounds = 0;
+    victim_tiers[id].sort(id, num_deques, [&](size_t v) -> const cpu_topology::cpu* {
+      if (v < num_pinned) return &topology.cpu_of(v);
+      const int index = seen_cpus[v].index.load(std::memory_order_relaxed);
+      return index < 0 ? nullptr : &topology.cpus[index];
+    });
+  }
+
+  // One round of hierarchical stealing: SMT siblings, then workers
+  // sharing the last level cache, then ones on the same socket, and a
+  // remote socket only if all of those came back empty. Each tier gets
+  // up to ISM_STEAL_TIER_ATTEMPTS distinct random victims. Victims whose
+  // cpu is not known yet are tried with the remote ones.
+  Job* try_steal_tiered(size_t id) {
+    const auto& tiers = victim_tiers[id];
+    uint32_t begin = 0;
+    for (size_t level = 0; level < cpu_topology::num_levels; ++level) {
+      const uint32_t n = tiers.end[level] - begin;
+      const size_t start = hash(id) + hash(attempts[id].val);
+      const uint32_t tries = std::min<uint32_t>(n, ISM_STEAL_TIER_ATTEMPTS);
+      for (uint32_t k = 0; k < tries; ++k) {
+        const uint32_t at = begin + static_cast<uint32_t>((start + k) % n);
+        size_t target = tiers.victims[at];
+        attempts[id].val++;
+        if (Job* job = steal_from(target)) {
+#ifdef profiling_stats
+          if (at >= tiers.first_unknown) attempts[id].unknown_steals++;
+          else if (level == cpu_topology::remote) attempts[id].remote_steals++;
+          else attempts[id].local_steals++;
+#endif
+          return job;
+        }
+      }
+      begin = tiers.end[level];
+    }
+    return nullptr;
+  }
+
+  Job* steal_from(size_t target) {
     while(1){
       auto [job, empty] = deques[target].pop_top();
       if(!job) break;
-      task_proxy* tmp  = dynamic_cast<task_proxy*>(job);
-      if(tmp) {
-        if(auto* result =  tmp->extract_task<task_proxy::pool_bit>()){
-          //felicity::safe_cout << "Succesfully!\n";
-          return result; 
-        }
-        allocator.delete_object(tmp);
-        //delete tmp;
+      task_proxy* tmp = task_proxy::from(job);
+      if(!tmp) {
+#if PARLAY_ELASTIC_PARALLELISM
+        wake_up_a_worker();
+#endif
+        return job;
       }
+      if(auto* result =  tmp->extract_task<task_proxy::pool_bit>()){
+        //felicity::safe_cout << "Succesfully!\n";
+#if PARLAY_ELASTIC_PARALLELISM
+        wake_up_a_worker();
+#endif
+        return result; 
+      }
+      local_pool().delete_object(tmp);
+      //delete tmp;
     }
     //felicity::safe_cout << "Aborted\n";
     return nullptr ;
   }
 
+#if PARLAY_ELASTIC_PARALLELISM
+
+  // Wakes up one sleeping worker, if there is any.
+  void wake_up_a_worker() {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (num_awake_workers.load(std::memory_order_relaxed) < num_threads) {
+      // Submitting threads have no worker id, and start anywhere.
+      const size_t start = worker_info.my_scheduler == this ? hash(attempts[worker_id()].val++) : 0;
+      for (size_t i = 0; i < sleepers.size(); ++i) {
+        if (wake_up_worker((start + i) % sleepers.size())) return;
+      }
+    }
+  }
+
+  // Wakes up the given worker if it is asleep. Callers must have
+  // published the work before, the fence pairs with the one in
+  // wait_for_work so that either the sleeper sees the work or we
+  // see it sleeping.
+  bool wake_up_worker(size_t id) {
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    auto& s = sleepers[id];
+    if (!s.sleeping.load(std::memory_order_relaxed)) return false;
+    s.epoch.fetch_add(1);
+    parlay::atomic_notify_one(&s.epoch);
+    return true;
+  }
+
+  // Wake up all sleeping workers
+  void wake_up_all_workers() {
+    for (auto& s : sleepers) {
+      s.epoch.fetch_add(1);
+      parlay::atomic_notify_one(&s.epoch);
+    }
+  }
+
+  // Sleep until woken. The worker stays marked idle, so it can be
+  // mailed to while asleep.
+  void wait_for_work() {
+    const auto id = worker_id();
+    auto& s = sleepers[id];
+    const auto epoch = s.epoch.load();
+    set_idle(id, true);
+    s.sleeping.store(true, std::memory_order_relaxed);
+    num_awake_workers.fetch_sub(1);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    if (!finished() && !work_available(id))
+      parlay::atomic_wait(&s.epoch, epoch);
+    s.sleeping.store(false, std::memory_order_relaxed);
+    num_awake_workers.fetch_add(1);
+    set_idle(id, false);
+  }
+
+  bool work_available(size_t id) {
+    if (!mail_inboxes[id]->empty() || !injected.empty()) return true;
+    for (const auto& d : deques)
+      if (d.size() > 0) return true;
+    return false;
+  }
+
+#endif
+
   void shutdown() {
     finished_flag.store(true, std::memory_order_release);
-    for (worker_id_type i = 1; i < num_threads; ++i) {
-      spawned_threads[i - 1].join();
+#if PARLAY_ELASTIC_PARALLELISM
+    // We must spam wake all workers until they finish in
+    // case any of them are just about to fall asleep, since
+    // they might therefore miss the flag to finish
+    while (num_finished_workers.load() < spawned_threads.size()) {
+      wake_up_all_workers();
+      std::this_thread::yield();
     }
+#endif
+    for (auto& thread : spawned_threads) thread.join();
   }
 };
 
@@ -381,52 +1001,123 @@ class fork_join_scheduler {
 
 public:
   template <typename L, typename R>
-  static void pardo(scheduler_t& scheduler, L&& left, R&& right, bool conservative = false, bool use_numa = false) {
+  static void pardo(scheduler_t& scheduler, L&& left, R&& right, bool conservative = false, bool use_numa = true) {
    
 
 
     //std::cout << cnt++ << std::endl;
 
     //auto execute_right = [&]() { std::forward<R>(right)(); };
+    latent_scope scope;
     auto right_job = make_job(right);
 
-    // Create a task_proxy forthe right job
-    task_proxy* proxy = scheduler.allocator.new_object<task_proxy>();
-    // Decide which thread to send the proxy to
-    auto target_id = scheduler.get_spawn_id_mailbox_random();
-       // Set up the proxy
-    //felicity::safe_cout << "the target_id is " << target_id << "\n";
-    proxy->task_and_tag = (intptr_t)(&right_job) |  task_proxy::location_mask;
-    proxy->outbox = (scheduler.mail_outboxes[target_id]);
-    proxy->slot = target_id;
-    //scheduler.mail_outboxes[target_id]->push(proxy);
-    proxy->outbox->push(proxy);
-    //cnt++;
-    //if(cnt > 1) scheduler.set_steal(); 
-    //felicity::safe_cout << "mailboxed to " << target_id << " by the tid: " << scheduler.worker_id() <<"\n";
-    // Push the proxy to the target mailbox
-    scheduler.spawn(proxy);
+    // Push the right job, mailing a proxy to an idle worker if there is one
+    if (!scheduler.spawn_mailed(&right_job)) {
+      // Our deque can not grow any further, run both sides here.
+      std::forward<L>(left)();
+      std::forward<R>(right)();
+      return;
+    }
     //scheduler.num_of_tasks[target_id]++;
     //scheduler.senders[scheduler.worker_id()]++;
     // Execute the left job
     std::forward<L>(left)();
 
+    // Nobody claimed the right job, run it here.
+    if (scheduler.try_reclaim(&right_job)) {
+      std::forward<R>(right)();
+      return;
+    }
+
     // Wait for the right job to finish
     auto done = [&]() { return right_job.finished(); };
-    scheduler.wait_until(done, conservative);
+    scheduler.wait_until(done, conservative, use_numa);
     assert(right_job.finished());
 
     // The proxy will be cleaned up by the thread that executes it
   }
- template <typename F>
+  // N-way pardo. The first function runs here, the others are pushed
+  // with one spawn_bulk and share one join counter, which each of them
+  // decrements as its last action.
+  template <typename F, typename... Fs>
+  static void invoke(scheduler_t& scheduler, F&& first, Fs&&... rest) {
+    if constexpr (sizeof...(Fs) == 0) {
+      std::forward<F>(first)();
+    } else {
+      constexpr size_t n = sizeof...(Fs);
+      latent_scope scope;
+      std::atomic<size_t> pending{n};
+      std::array<invoke_branch, n> branches;
+      size_t i = 0;
+      ((branches[i++].bind(rest, pending)), ...);
+      // The second function goes to the bottom, where we pop it first.
+      std::array<Job*, n> order;
+      for (size_t j = 0; j < n; ++j) order[j] = &branches[n - 1 - j];
+      if (!scheduler.spawn_bulk(order.data(), n)) {
+        std::forward<F>(first)();
+        (std::forward<Fs>(rest)(), ...);
+        return;
+      }
+      std::forward<F>(first)();
+      scheduler.reclaim_bulk(order.data(), n);
+      auto done = [&]() { return pending.load(std::memory_order_acquire) == 0; };
+      scheduler.wait_until(done);
+    }
+  }
+
+  // Heartbeat variant of pardo. Both sides run on the calling worker
+  // and right stays latent, invisible to thieves, unless a heartbeat
+  // promotes it to a task while left is still running. Beats are polled
+  // on entry, and each one promotes the oldest latent branch of the
+  // worker, which carries the most work.
+  //
+  // The scheduler is only looked up on a beat or to join a promoted
+  // branch, a latent branch costs a few thread local loads and stores.
+  template <typename L, typename R>
+  static void heartbeat_pardo(L&& left, R&& right, bool conservative = false) {
+    auto right_job = make_job(right);
+    latent_frame frame{&right_job, newest_frame, false};
+    newest_frame = &frame;
+    if (--beat_countdown == 0) heartbeat();
+
+    std::forward<L>(left)();
+
+    // Everything pushed above this frame has been popped again.
+    assert(newest_frame == &frame);
+    newest_frame = frame.older;
+
+    if (!frame.promoted) {
+      std::forward<R>(right)();
+      return;
+    }
+    scheduler_t& scheduler = *scheduler_t::get_current_scheduler();
+    if (scheduler.try_reclaim(&right_job)) {
+      std::forward<R>(right)();
+      return;
+    }
+    auto done = [&]() { return right_job.finished(); };
+    scheduler.wait_until(done, conservative);
+    assert(right_job.finished());
+  }
+
+  template <typename F>
   static void parfor(scheduler_t& scheduler, size_t start, size_t end, F&& f, size_t granularity = 0, bool conservative = false) {
     if (end <= start) return;
     if (granularity == 0) {
       size_t done = get_granularity(start, end, f);
+#if ISM_LAZY_SPLITTING
+      // Splitting adapts to the load, the chunk only has to amortise the poll.
+      granularity = done;
+#else
       granularity = std::max(done, (end - start) / static_cast<size_t>(128 * scheduler.num_threads));
+#endif
       start += done;
     }
+#if ISM_LAZY_SPLITTING
+    parfor_lazy(scheduler, start, end, f, granularity, conservative);
+#else
     parfor_(scheduler, start, end, f,granularity, conservative);
+#endif
     //std::cout << "Tasks\n";
     //for(auto i = 0; i<scheduler.num_of_tasks.size() ;i++){
     //  std::cout << scheduler.num_of_tasks[i] << " ";
@@ -439,8 +1130,174 @@ public:
 
   } 
 
+
+  // parfor over a blocked_range2d or blocked_range3d. The range is
+  // bisected along its longest dimension, counted in grains, until no
+  // dimension is divisible. Tiles thus run in recursive, Morton like
+  // order, and a thief takes a contiguous block of them, whose cache
+  // lines its neighbours share.
+  template <typename Range, typename F>
+  static void parfor_tiles(scheduler_t& scheduler, const Range& range, F& f, bool conservative = false) {
+    auto halves = bisect(range);
+    if (!halves) {
+      f(range);
+      return;
+    }
+    pardo(scheduler,
+          [&]() { parfor_tiles(scheduler, halves->first, f, conservative); },
+          [&]() { parfor_tiles(scheduler, halves->second, f, conservative); },
+          conservative);
+  }
+
+  // Reduces [start, end) without shared state: f(range, acc) folds a
+  // chunk into acc, every leaf of the split tree starts from identity,
+  // and the partial results are combined at the pardo joins in range
+  // order, so combine only has to be associative.
+  template <typename T, typename F, typename C>
+  static T parreduce(scheduler_t& scheduler, size_t start, size_t end, T identity, F&& f, C&& combine,
+                     size_t granularity = 0, bool conservative = false) {
+    if (end <= start) return identity;
+    T acc = identity;
+    if (granularity == 0) {
+      auto fold = [&](tbb::blocked_range<size_t> r) { acc = f(r, std::move(acc)); };
+      size_t done = get_granularity(start, end, fold);
+#if ISM_LAZY_SPLITTING
+      granularity = done;
+#else
+      granularity = std::max(done, (end - start) / static_cast<size_t>(128 * scheduler.num_threads));
+#endif
+      start += done;
+      if (start == end) return acc;
+    }
+#if ISM_LAZY_SPLITTING
+    T rest = parreduce_lazy(scheduler, start, end, identity, f, combine, granularity, conservative);
+#else
+    T rest = parreduce_(scheduler, start, end, identity, f, combine, granularity, conservative);
+#endif
+    return combine(std::move(acc), std::move(rest));
+  }
   
  private:
+  // A branch of invoke, type erased so that all branches fit one array.
+  // The invoking frame may be gone once pending is decremented, so the
+  // job is detached and never touched after that.
+  struct invoke_branch : WorkStealingJob {
+    invoke_branch() : WorkStealingJob(job_kind::detached) {}
+
+    template <typename F>
+    void bind(F& f, std::atomic<size_t>& p) {
+      fn = const_cast<void*>(static_cast<const void*>(&f));
+      call = [](void* g) { (*static_cast<F*>(g))(); };
+      pending = &p;
+    }
+
+   protected:
+    void execute() override {
+      call(fn);
+      pending->fetch_sub(1, std::memory_order_release);
+    }
+
+   private:
+    void* fn = nullptr;
+    void (*call)(void*) = nullptr;
+    std::atomic<size_t>* pending = nullptr;
+  };
+
+  using range1d = tbb::blocked_range<size_t>;
+  using range2d = tbb::blocked_range2d<size_t>;
+  using range3d = tbb::blocked_range3d<size_t>;
+
+  // Grains in d, for picking the dimension to split.
+  static double grains(const range1d& d) {
+    return static_cast<double>(d.size()) / static_cast<double>(d.grainsize());
+  }
+
+  static size_t middle(const range1d& d) { return d.begin() + d.size() / 2; }
+
+  static std::optional<std::pair<range2d, range2d>> bisect(const range2d& r) {
+    const auto& rows = r.rows();
+    const auto& cols = r.cols();
+    if (rows.is_divisible() && (!cols.is_divisible() || grains(rows) >= grains(cols))) {
+      size_t mid = middle(rows);
+      return std::pair{range2d(rows.begin(), mid, rows.grainsize(), cols.begin(), cols.end(), cols.grainsize()),
+                       range2d(mid, rows.end(), rows.grainsize(), cols.begin(), cols.end(), cols.grainsize())};
+    }
+    if (cols.is_divisible()) {
+      size_t mid = middle(cols);
+      return std::pair{range2d(rows.begin(), rows.end(), rows.grainsize(), cols.begin(), mid, cols.grainsize()),
+                       range2d(rows.begin(), rows.end(), rows.grainsize(), mid, cols.end(), cols.grainsize())};
+    }
+    return std::nullopt;
+  }
+
+  static std::optional<std::pair<range3d, range3d>> bisect(const range3d& r) {
+    const auto& pages = r.pages();
+    const auto& rows = r.rows();
+    const auto& cols = r.cols();
+    auto make = [&](const range1d& p, const range1d& r, const range1d& c) {
+      return range3d(p.begin(), p.end(), p.grainsize(), r.begin(), r.end(), r.grainsize(),
+                     c.begin(), c.end(), c.grainsize());
+    };
+    auto halves = [](const range1d& d) {
+      size_t mid = middle(d);
+      return std::pair{range1d(d.begin(), mid, d.grainsize()), range1d(mid, d.end(), d.grainsize())};
+    };
+    const double gp = pages.is_divisible() ? grains(pages) : 0;
+    const double gr = rows.is_divisible() ? grains(rows) : 0;
+    const double gc = cols.is_divisible() ? grains(cols) : 0;
+    if (gp == 0 && gr == 0 && gc == 0) return std::nullopt;
+    if (gp >= gr && gp >= gc) {
+      auto [a, b] = halves(pages);
+      return std::pair{make(a, rows, cols), make(b, rows, cols)};
+    }
+    if (gr >= gc) {
+      auto [a, b] = halves(rows);
+      return std::pair{make(pages, a, cols), make(pages, b, cols)};
+    }
+    auto [a, b] = halves(cols);
+    return std::pair{make(pages, rows, a), make(pages, rows, b)};
+  }
+
+  struct latent_frame {
+    Job* job;
+    latent_frame* older;
+    bool promoted;
+  };
+
+  // The open heartbeat_pardo frames of this worker, newest first. Frames
+  // from latent_floor on belong to code outside the innermost pardo,
+  // whose job is already on the deque. Promoting one of them would put
+  // its job above that one and break the LIFO order the joins rely on.
+  static inline thread_local latent_frame* newest_frame = nullptr;
+  static inline thread_local latent_frame* latent_floor = nullptr;
+
+  // The clock is read every beat_poll_interval heartbeat_pardo calls.
+  static constexpr int beat_poll_interval = 64;
+  static inline thread_local int beat_countdown = beat_poll_interval;
+  static inline thread_local std::chrono::steady_clock::time_point last_beat{};
+
+  // Hides the open latent frames from heartbeats for its lifetime.
+  struct latent_scope {
+    latent_frame* saved_floor;
+    latent_scope() : saved_floor(latent_floor) { latent_floor = newest_frame; }
+    ~latent_scope() { latent_floor = saved_floor; }
+  };
+
+  static void heartbeat() {
+    beat_countdown = beat_poll_interval;
+    auto now = std::chrono::steady_clock::now();
+    if (now - last_beat < std::chrono::microseconds(ISM_HEARTBEAT_US)) return;
+    last_beat = now;
+    // Beats are rare, walking the frames for the oldest latent one is fine.
+    latent_frame* oldest = nullptr;
+    for (latent_frame* f = newest_frame; f != latent_floor; f = f->older)
+      if (!f->promoted) oldest = f;
+    scheduler_t* scheduler = scheduler_t::get_current_scheduler();
+    if (!oldest || !scheduler) return;
+    // If the deque can not grow the branch just stays latent.
+    if (scheduler->spawn_mailed(oldest->job)) oldest->promoted = true;
+  }
+
   template <typename F>
   static size_t get_granularity(size_t start, size_t end, F& f) {
     size_t done = 0;
@@ -478,5 +1335,64 @@ public:
             conservative);
     }
   }
+
+  template <typename T, typename F, typename C>
+  static T parreduce_(scheduler_t& scheduler, size_t start, size_t end, const T& identity, F& f, C& combine,
+                      size_t granularity, bool conservative) {
+    if ((end - start) <= granularity) return f(tbb::blocked_range<size_t>(start, end), identity);
+    size_t mid = (start + granularity);
+    T left = identity, right = identity;
+    pardo(scheduler,
+          [&]() { right = parreduce_(scheduler, mid, end, identity, f, combine, granularity, conservative); },
+          [&]() { left = parreduce_(scheduler, start, mid, identity, f, combine, granularity, conservative); },
+          conservative);
+    return combine(std::move(left), std::move(right));
+  }
+
+  // Runs [start, end) in chunks of granularity, and whenever the worker
+  // should split gives the second half of the rest to a pardo. A loop
+  // starts with O(log P) splits and only splits further as thieves
+  // take work.
+  template <typename F>
+  static void parfor_lazy(scheduler_t& scheduler, size_t start, size_t end, F& f, size_t granularity, bool conservative) {
+    if (granularity == 0) granularity = 1;
+    while (end - start > granularity) {
+      if (end - start >= 2 * granularity && scheduler.wants_split()) {
+        size_t mid = start + (end - start) / 2;
+        pardo(scheduler,
+              [&]() { parfor_lazy(scheduler, start, mid, f, granularity, conservative); },
+              [&]() { parfor_lazy(scheduler, mid, end, f, granularity, conservative); },
+              conservative);
+        return;
+      }
+      f(tbb::blocked_range<size_t>(start, start + granularity));
+      start += granularity;
+    }
+    if (start < end) f(tbb::blocked_range<size_t>(start, end));
+  }
+
+  // parfor_lazy for parreduce. The chunks run so far are folded into acc
+  // before the rest is split.
+  template <typename T, typename F, typename C>
+  static T parreduce_lazy(scheduler_t& scheduler, size_t start, size_t end, const T& identity, F& f, C& combine,
+                          size_t granularity, bool conservative) {
+    if (granularity == 0) granularity = 1;
+    T acc = identity;
+    while (end - start > granularity) {
+      if (end - start >= 2 * granularity && scheduler.wants_split()) {
+        size_t mid = start + (end - start) / 2;
+        T left = identity, right = identity;
+        pardo(scheduler,
+              [&]() { left = parreduce_lazy(scheduler, start, mid, identity, f, combine, granularity, conservative); },
+              [&]() { right = parreduce_lazy(scheduler, mid, end, identity, f, combine, granularity, conservative); },
+              conservative);
+        return combine(std::move(acc), combine(std::move(left), std::move(right)));
+      }
+      acc = f(tbb::blocked_range<size_t>(start, start + granularity), std::move(acc));
+      start += granularity;
+    }
+    if (start < end) acc = f(tbb::blocked_range<size_t>(start, end), std::move(acc));
+    return acc;
+  }
  }; 
 
@@ -98,6 +98,11 @@ struct scheduler {
   // before it goes to sleep to save CPU time.
   constexpr static std::chrono::microseconds STEAL_TIMEOUT{PARLAY_ELASTIC_STEAL_TIMEOUT};
 
+  // Victims with at least STEAL_BATCH_MIN_DEPTH jobs are robbed of up to
+  // half of them, at most STEAL_BATCH_MAX, in one steal.
+  constexpr static int64_t STEAL_BATCH_MIN_DEPTH = 4;
+  constexpr static size_t STEAL_BATCH_MAX = 64;
+
   static inline thread_local workerInfo worker_info{};
 
  public:
@@ -322,7 +327,11 @@ struct scheduler {
     attempts[id].val++;
     #ifdef chase 
     
-    auto job = queues[target].steal();
+    // From a deep victim take up to half of its jobs at once, so that a
+    // worker joining a wide parfor builds up its own backlog in one step.
+    auto job = queues[target].size() >= STEAL_BATCH_MIN_DEPTH
+                 ? queues[target].steal_batch(STEAL_BATCH_MAX, queues[id])
+                 : queues[target].steal();
     #else 
     auto [job,empty] = queues[target].pop_top();
     #endif
@@ -402,8 +411,15 @@ class fork_join_scheduler {
     auto right_job = make_job(right);
     scheduler.spawn(&right_job);
     std::forward<L>(left)();
-    if (const Job* job = scheduler.get_own_job(); job != nullptr) {
-      assert(job == &right_job);
+    // A batch steal while left waited may have left jobs between
+    // right_job and the bottom, run them first. Thieves take from the
+    // top, so right_job is either still further up or was stolen.
+    Job* job = scheduler.get_own_job();
+    while (job != nullptr && job != &right_job) {
+      (*job)();
+      job = scheduler.get_own_job();
+    }
+    if (job != nullptr) {
       execute_right();
     }
     else {
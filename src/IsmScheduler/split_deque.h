@@ -4,9 +4,12 @@
 #include <cassert>
 
 #include <atomic>
+#include <bit>
 #include <cwchar>
 #include <iostream>
 #include <iterator>
+#include <limits>
+#include <new>
 #include <utility>
 #include <array>
 #include <iostream>
@@ -14,6 +17,62 @@
 
 #define profiling_stats1 1
 
+// Job slots in chunks of geometrically growing size that are allocated
+// by the owner when the deque first reaches them, so memory scales with
+// the peak occupancy of the deque. Chunks are only released when the
+// deque is destroyed, so a stealer can always read a slot below the
+// bottom it observed while the owner grows the deque.
+template <typename Job>
+struct chunked_slots {
+  using qidx = unsigned int;
+
+  // Chunk k holds first_chunk_size << k slots, enough chunks to cover
+  // every qidx.
+  static constexpr qidx first_chunk_size = 256;
+  static constexpr int max_chunks = 25;
+  static_assert((uint64_t(first_chunk_size) << max_chunks) - first_chunk_size >= std::numeric_limits<qidx>::max());
+
+  alignas(64) std::array<std::atomic<std::atomic<Job*>*>, max_chunks> chunks{};
+
+  chunked_slots() = default;
+  chunked_slots(const chunked_slots&) = delete;
+  chunked_slots& operator=(const chunked_slots&) = delete;
+
+  ~chunked_slots() {
+    for (auto& c : chunks) delete[] c.load(std::memory_order_relaxed);
+  }
+
+  static int chunk_of(qidx i) {
+    return std::bit_width(i / first_chunk_size + 1) - 1;
+  }
+
+  std::atomic<Job*>& slot(qidx i) {
+    const int k = chunk_of(i);
+    const qidx offset = i - first_chunk_size * ((qidx(1) << k) - 1);
+    return chunks[k].load(std::memory_order_acquire)[offset];
+  }
+
+  // Makes sure the slot at index i exists. Only the owner may call this.
+  bool reserve(qidx i) {
+    const int k = chunk_of(i);
+    if (k >= max_chunks) return false;
+    if (chunks[k].load(std::memory_order_relaxed)) return true;
+    auto* chunk = new (std::nothrow) std::atomic<Job*>[size_t(first_chunk_size) << k];
+    if (!chunk) return false;
+    chunks[k].store(chunk, std::memory_order_release);
+    return true;
+  }
+
+  // Bytes currently allocated for slots.
+  size_t footprint() const {
+    size_t bytes = 0;
+    for (int k = 0; k < max_chunks; ++k)
+      if (chunks[k].load(std::memory_order_relaxed))
+        bytes += (size_t(first_chunk_size) << k) * sizeof(std::atomic<Job*>);
+    return bytes;
+  }
+};
+
 // Deque from Arora, Blumofe, and Plaxton (SPAA, 1998).
 //
 // Supports:
@@ -22,11 +81,15 @@
 // pop_bottom:    Only the owning thread may call this
 // pop_top:       Non-owning threads may call this
 //
+// Slots are plain 8 byte job pointers packed densely in chunked_slots,
+// only bot and age get a cache line of their own.
 
 template <typename Job>
-struct Deque {
+struct Deque : chunked_slots<Job> {
   using qidx = unsigned int;
   using tag_t = unsigned int;
+  using chunked_slots<Job>::slot;
+  using chunked_slots<Job>::reserve;
 
   // use std::atomic<age_t> for atomic access.
   // Note: Explicit alignment specifier required
@@ -38,20 +101,14 @@ struct Deque {
   };
 
   // align to avoid false sharing
-  struct alignas(64) padded_job {
-    std::atomic<Job*> job;
-  };    
-
-  static constexpr int q_size = 20000;
-  std::atomic<qidx> bot;
-  std::atomic<age_t> age;
+  alignas(64) std::atomic<qidx> bot;
+  alignas(64) std::atomic<age_t> age;
 
 #ifdef profiling_stats
   int pushBottom, popBottom, popTop, success;
   long long cas, fence;
 
 #endif //profiling_stats
-  std::array<padded_job, q_size> deq;
 
 
   Deque() : bot(0),
@@ -59,35 +116,6 @@ struct Deque {
             pushBottom(0), popBottom(0), popTop(0), cas(0), fence(0), success(0),
 #endif
  age(age_t{0, 0}) {}
-  void cleanup() {
-    auto size_loc = size();
-    auto local_bot = bot.load(std::memory_order_acquire);
-    auto old_age = age.load(std::memory_order_acquire);
-
-    for (qidx i = old_age.top; i < local_bot; ++i) {
-        Job* job = deq[i].job.load(std::memory_order_acquire);
-        if(!job) break;
-        task_proxy* tp = dynamic_cast<task_proxy*>(tp);
-        
-        if (tp && tp->is_accessed_()) {  // Assuming Job has a method `is_done()`
-            
-            delete tp;  // Delete the job
-            deq[i].job.store(nullptr, std::memory_order_release);  // Clear the job from the deque
-        }
-    }
-
-    // Update the top index if possible (e.g., if all jobs before a certain index are done)
-    while (old_age.top < local_bot && !deq[old_age.top].job.load(std::memory_order_acquire)) {
-        ++old_age.top;
-    }
-
-    age.store(old_age, std::memory_order_release);
-    auto size_new_loc = size();
-    std::cout << "\nCLEANUP\n" << "old size was: " << size_loc << " and new size: " << size_new_loc << "\n";
-
-
-}
-
 
   int size() const {
     auto local_bot = bot.load(std::memory_order_acquire);  // Load the current bottom index
@@ -98,26 +126,39 @@ struct Deque {
   // thread can push new items. This must not be called by any
   // other thread.
   //
-  // Returns true if the queue was empty before this push
+  // Returns false, leaving the queue unchanged, if the queue is full
+  // and can not grow. The caller must then run the job itself.
   bool push_bottom(Job* job) {
-    //static volatile int cnt = 0;
-    //if(++cnt %128 == 0) cleanup();
     auto local_bot = bot.load(std::memory_order_acquire);      // atomic load
-    deq[local_bot].job.store(job, std::memory_order_release);  // shared store
+    if (local_bot == std::numeric_limits<qidx>::max() || !reserve(local_bot)) return false;
+    slot(local_bot).store(job, std::memory_order_release);  // shared store
     local_bot += 1;
-    if (local_bot == q_size) {
-      std::cerr << "internal error: scheduler queue overflow\n";
-      std::abort();
-    }
     bot.store(local_bot, std::memory_order_seq_cst);  // shared store
-    Job* tmp = deq[local_bot-1].job.load();
 
 
 
 #ifdef profiling_stats
     pushBottom++;
 #endif 
-    return (local_bot == 1);
+    return true;
+  }
+
+  // Pushes jobs[0], ..., jobs[n - 1] with a single publishing store, so
+  // jobs[n - 1] ends up at the bottom. Only the owning thread may call
+  // this.
+  //
+  // Returns false, leaving the queue unchanged, if they do not all fit.
+  bool push_bottom_bulk(Job* const* jobs, size_t n) {
+    auto local_bot = bot.load(std::memory_order_acquire);
+    if (n > std::numeric_limits<qidx>::max() - local_bot) return false;
+    for (size_t i = 0; i < n; ++i)
+      if (!reserve(local_bot + i)) return false;
+    for (size_t i = 0; i < n; ++i) slot(local_bot + i).store(jobs[i], std::memory_order_relaxed);
+    bot.store(local_bot + n, std::memory_order_seq_cst);
+#ifdef profiling_stats
+    pushBottom += n;
+#endif
+    return true;
   }
 
   // Pop an item from the top of the queue, i.e., the end that is not
@@ -133,7 +174,7 @@ struct Deque {
 #endif 
 
     if (local_bot > old_age.top) {
-      auto job = deq[old_age.top].job.load(std::memory_order_acquire);  // atomic load
+      auto job = slot(old_age.top).load(std::memory_order_acquire);  // atomic load
       auto new_age = old_age;
       new_age.top = new_age.top + 1;
 #ifdef profiling_stats
@@ -163,7 +204,7 @@ struct Deque {
       bot.store(local_bot, std::memory_order_release);  // shared store
       std::atomic_thread_fence(std::memory_order_seq_cst);
       auto job =
-        deq[local_bot].job.load(std::memory_order_acquire);  // atomic load
+        slot(local_bot).load(std::memory_order_acquire);  // atomic load
       auto old_age = age.load(std::memory_order_acquire);      // atomic load
 #ifdef profiling_stats
       fence++;
@@ -0,0 +1,146 @@
+#pragma once
+#include <cassert>
+#include <cstddef>
+#include <cstdlib>
+
+#include <atomic>
+#include <functional>
+#include <iostream>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "parallel_for.h"
+
+// Static task graph on scheduler_ism.
+//
+// Nodes are added with add_node, dependencies with add_edge, and run()
+// executes every node once all its predecessors have finished, without
+// the joins nested parallel_do would put between independent branches.
+// Each node counts its unfinished predecessors. The worker that takes a
+// count to zero runs one of the newly ready successors itself and spawns
+// the others onto its deque, mailing them to idle workers.
+//
+// Those spawns are never joined. A node body that forks with parallel_do
+// or parallel_for may therefore find a successor below its own branch at
+// the bottom of the deque. The joins push such entries back and wait, so
+// the successor runs later or is stolen, see scheduler_ism::try_reclaim.
+//
+// A graph can be run any number of times, run() only resets the counts.
+// Nodes must not be added while it runs.
+class task_graph {
+ public:
+  using node_id = std::size_t;
+
+  task_graph() = default;
+  task_graph(const task_graph&) = delete;
+  task_graph& operator=(const task_graph&) = delete;
+
+  template <typename F>
+  node_id add_node(F&& f) {
+    static_assert(std::is_invocable_v<F&>);
+    nodes.push_back(std::make_unique<node>(*this, nodes.size(), std::forward<F>(f)));
+    checked = false;
+    return nodes.size() - 1;
+  }
+
+  // to runs after from has finished.
+  void add_edge(node_id from, node_id to) {
+    assert(from < nodes.size() && to < nodes.size());
+    nodes[from]->successors.push_back(nodes[to].get());
+    nodes[to]->num_predecessors++;
+    checked = false;
+  }
+
+  std::size_t size() const { return nodes.size(); }
+
+  // Runs the graph on the current scheduler and returns once every node
+  // has run. The calling worker helps with other work meanwhile.
+  void run() {
+    if (nodes.empty()) return;
+    if (!checked) check_acyclic();
+    with_scheduler([&](scheduler_t& scheduler) {
+      remaining.store(nodes.size(), std::memory_order_relaxed);
+      for (auto& n : nodes) n->pending.store(n->num_predecessors, std::memory_order_relaxed);
+      // Publishes the counts to the workers that pick up the sources.
+      std::atomic_thread_fence(std::memory_order_release);
+      for (auto& n : nodes)
+        if (n->num_predecessors == 0) start(scheduler, n.get());
+      scheduler.wait_until([&]() { return remaining.load(std::memory_order_acquire) == 0; });
+    });
+  }
+
+ private:
+  using scheduler_t = scheduler_ism<WorkStealingJob>;
+
+  // Nodes run once per run(), and the graph may be destroyed as soon as
+  // the last one finished, so they never mark themselves done.
+  struct node : WorkStealingJob {
+    template <typename F>
+    node(task_graph& g, node_id i, F&& f)
+        : WorkStealingJob(job_kind::detached), graph(g), id(i), body(std::forward<F>(f)) {}
+
+    task_graph& graph;
+    const node_id id;
+    std::function<void()> body;
+    std::vector<node*> successors;
+    std::size_t num_predecessors = 0;
+    std::atomic<std::size_t> pending{0};
+
+   protected:
+    void execute() override {
+      node* n = this;
+      while (n) n = n->run_and_release();
+    }
+
+   private:
+    // Runs the body and returns the successor to run next, if any
+    // became ready. The other ready ones are left to the scheduler, no
+    // join takes them back.
+    node* run_and_release() {
+      body();
+      node* next = nullptr;
+      auto* scheduler = scheduler_t::get_current_scheduler();
+      for (node* s : successors) {
+        if (s->pending.fetch_sub(1, std::memory_order_acq_rel) != 1) continue;
+        if (next) graph.start(*scheduler, next);
+        next = s;
+      }
+      // Nothing may touch the graph once the last node is counted.
+      graph.remaining.fetch_sub(1, std::memory_order_acq_rel);
+      return next;
+    }
+  };
+
+  void start(scheduler_t& scheduler, node* n) {
+    // A full deque leaves n to this worker.
+    if (!scheduler.spawn_mailed(n)) (*n)();
+  }
+
+  // A cycle would leave run() waiting forever, reject it up front.
+  void check_acyclic() {
+    std::vector<std::size_t> indegree(nodes.size());
+    std::vector<node*> ready;
+    for (node_id i = 0; i < nodes.size(); ++i) {
+      indegree[i] = nodes[i]->num_predecessors;
+      if (indegree[i] == 0) ready.push_back(nodes[i].get());
+    }
+    std::size_t visited = 0;
+    while (!ready.empty()) {
+      node* n = ready.back();
+      ready.pop_back();
+      ++visited;
+      for (node* s : n->successors)
+        if (--indegree[s->id] == 0) ready.push_back(s);
+    }
+    if (visited != nodes.size()) {
+      std::cerr << "task_graph: the graph has a cycle\n";
+      std::abort();
+    }
+    checked = true;
+  }
+
+  std::vector<std::unique_ptr<node>> nodes;
+  std::atomic<std::size_t> remaining{0};
+  bool checked = false;
+};
@@ -0,0 +1,313 @@
+#pragma once
+#include <sched.h>
+
+#include <algorithm>
+#include <array>
+#include <cstddef>
+#include <cstdint>
+#include <cstdlib>
+#include <fstream>
+#include <string>
+#include <thread>
+#include <tuple>
+#include <vector>
+
+struct pinning;
+
+// CPU topology as reported by Linux sysfs.
+//
+// Only the cpus in the affinity mask of the calling thread are listed.
+// If sysfs can not be read every cpu is reported as its own core in a
+// single cache domain, socket and node, so that all consumers degrade
+// to topology-oblivious behaviour.
+struct cpu_topology {
+  struct cpu {
+    int id;        // logical cpu number
+    int core;      // first logical cpu of the physical core (SMT siblings share it)
+    int llc;       // first logical cpu sharing the last level cache
+    int package;   // physical socket
+    int node;      // NUMA node
+  };
+
+  std::vector<cpu> cpus;
+
+  static cpu_topology discover() {
+    cpu_topology topo;
+    std::vector<int> node_of(CPU_SETSIZE, 0);
+    for (int node = 0;; ++node) {
+      std::vector<int> list;
+      if (!read_cpu_list("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist", list)) break;
+      for (int c : list)
+        if (c < CPU_SETSIZE) node_of[c] = node;
+    }
+
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (sched_getaffinity(0, sizeof(mask), &mask) != 0) {
+      for (int c = 0; c < static_cast<int>(std::thread::hardware_concurrency()) && c < CPU_SETSIZE; ++c)
+        CPU_SET(c, &mask);
+    }
+
+    for (int c = 0; c < CPU_SETSIZE; ++c) {
+      if (!CPU_ISSET(c, &mask)) continue;
+      const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(c);
+      cpu info{c, c, 0, 0, node_of[c]};
+      std::vector<int> list;
+      if (read_cpu_list(base + "/topology/thread_siblings_list", list) && !list.empty())
+        info.core = list.front();
+      // index3 is the L3 on every x86 and most arm parts, fall back to
+      // the L2 for machines without one.
+      if ((read_cpu_list(base + "/cache/index3/shared_cpu_list", list) ||
+           read_cpu_list(base + "/cache/index2/shared_cpu_list", list)) && !list.empty())
+        info.llc = list.front();
+      info.package = read_int(base + "/topology/physical_package_id", 0);
+      topo.cpus.push_back(info);
+    }
+    if (topo.cpus.empty()) topo.cpus.push_back(cpu{0, 0, 0, 0, 0});
+    return topo;
+  }
+
+  // Distance classes between two cpus, closest first.
+  enum level : std::size_t { smt = 0, cache = 1, socket = 2, remote = 3 };
+  static constexpr std::size_t num_levels = 4;
+
+  static level distance(const cpu& a, const cpu& b) {
+    if (a.core == b.core) return smt;
+    if (a.llc == b.llc && a.package == b.package) return cache;
+    if (a.package == b.package || a.node == b.node) return socket;
+    return remote;
+  }
+
+  // Bytes of the data or unified cache at level (1 for L1 and so on) of
+  // the calling thread's first cpu, or fallback if sysfs does not say.
+  static std::size_t cache_size(int level, std::size_t fallback) {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    int first = 0;
+    if (sched_getaffinity(0, sizeof(mask), &mask) == 0)
+      while (first < CPU_SETSIZE - 1 && !CPU_ISSET(first, &mask)) ++first;
+    const std::string base = "/sys/devices/system/cpu/cpu" + std::to_string(first) + "/cache/index";
+    for (int index = 0;; ++index) {
+      const std::string dir = base + std::to_string(index);
+      const int l = read_int(dir + "/level", -1);
+      if (l < 0) break;
+      std::ifstream type_in(dir + "/type");
+      std::string type;
+      if (l != level || !(type_in >> type) || type == "Instruction") continue;
+      std::ifstream size_in(dir + "/size");
+      std::size_t size;
+      std::string unit;
+      if (!(size_in >> size)) break;
+      // "2048K", the unit follows the number.
+      if (size_in >> unit) size <<= unit[0] == 'M' ? 20 : unit[0] == 'K' ? 10 : 0;
+      return size;
+    }
+    return fallback;
+  }
+
+  // The cpu that worker i runs on once bind pinned it to one.
+  const cpu& cpu_of(std::size_t worker) const {
+    return cpus[worker % cpus.size()];
+  }
+
+  // Position in cpus of every logical cpu number, -1 for those outside
+  // the process cpuset.
+  std::vector<int> index_by_id() const {
+    std::vector<int> index(CPU_SETSIZE, -1);
+    for (std::size_t i = 0; i < cpus.size(); ++i) index[cpus[i].id] = static_cast<int>(i);
+    return index;
+  }
+
+  // Restricts the calling thread to the cpu of worker, or for cpuset to
+  // any listed cpu. Returns false if the kernel refused.
+  bool bind(std::size_t worker, bool whole_set) const {
+    cpu_set_t mask;
+    CPU_ZERO(&mask);
+    if (whole_set) {
+      for (const cpu& c : cpus) CPU_SET(c.id, &mask);
+    } else {
+      CPU_SET(cpu_of(worker).id, &mask);
+    }
+    return sched_setaffinity(0, sizeof(mask), &mask) == 0;
+  }
+
+  // Parses lists of the form "0-3,8,10-11".
+  static bool parse_cpu_list(const std::string& text, std::vector<int>& out) {
+    if (text.empty() || text.find_first_not_of("0123456789,-") != std::string::npos) return false;
+    out.clear();
+    std::size_t pos = 0;
+    while (pos < text.size()) {
+      std::size_t end = text.find(',', pos);
+      if (end == std::string::npos) end = text.size();
+      const std::string item = text.substr(pos, end - pos);
+      const std::size_t dash = item.find('-');
+      if (item.empty() || dash == 0 || dash + 1 == item.size()) return false;
+      const int lo = std::stoi(item.substr(0, dash));
+      const int hi = dash == std::string::npos ? lo : std::stoi(item.substr(dash + 1));
+      for (int c = lo; c <= hi && c < CPU_SETSIZE; ++c) out.push_back(c);
+      pos = end + 1;
+    }
+    return true;
+  }
+
+ private:
+  friend cpu_topology place(cpu_topology topo, const pinning& pin);
+
+  static int read_int(const std::string& path, int fallback) {
+    std::ifstream in(path);
+    int value;
+    return (in >> value) ? value : fallback;
+  }
+
+  static bool read_cpu_list(const std::string& path, std::vector<int>& out) {
+    std::ifstream in(path);
+    std::string text;
+    return (in >> text) && parse_cpu_list(text, out);
+  }
+
+  // Position of every cpu in the compact order, and its rank among the
+  // cpus of its core, the cores of its cache, and the caches of its
+  // socket, which scatter sorts by instead.
+  struct rank {
+    std::size_t compact, thread, core, llc;
+  };
+
+  std::vector<rank> ranks() const {
+    std::vector<std::size_t> order(cpus.size());
+    for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+    std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+      const cpu& x = cpus[a];
+      const cpu& y = cpus[b];
+      return std::tie(x.package, x.node, x.llc, x.core, x.id) < std::tie(y.package, y.node, y.llc, y.core, y.id);
+    });
+    std::vector<rank> r(cpus.size());
+    for (std::size_t i = 0; i < order.size(); ++i) {
+      const cpu& c = cpus[order[i]];
+      rank& k = r[order[i]];
+      k.compact = i;
+      if (i == 0) continue;
+      const rank& prev = r[order[i - 1]];
+      const cpu& p = cpus[order[i - 1]];
+      if (p.package != c.package) continue;
+      if (p.llc != c.llc || p.node != c.node) {
+        k.llc = prev.llc + 1;
+      } else if (p.core != c.core) {
+        k.llc = prev.llc;
+        k.core = prev.core + 1;
+      } else {
+        k = {i, prev.thread + 1, prev.core, prev.llc};
+      }
+    }
+    return r;
+  }
+};
+
+// Where the workers of a scheduler run.
+enum class pin_policy {
+  none,     // wherever the OS puts them
+  compact,  // one per cpu, filling a core, then a cache, then a socket
+  scatter,  // one per cpu, one per socket first, then per cache and core
+  cpuset,   // ordered as compact, but free to move within the process cpuset
+  list,     // one per cpu of an explicit list, in list order
+};
+
+struct pinning {
+  pin_policy policy = pin_policy::none;
+  std::vector<int> cpus;  // for pin_policy::list
+
+  // Reads ISM_PIN, which is one of none, compact, scatter and cpuset,
+  // or a cpu list such as "0-3,8". Unset or unparsable means none.
+  static pinning from_env() {
+    const char* env = std::getenv("ISM_PIN");
+    return env ? parse(env) : pinning{};
+  }
+
+  static pinning parse(const std::string& text) {
+    if (text == "compact") return {pin_policy::compact, {}};
+    if (text == "scatter") return {pin_policy::scatter, {}};
+    if (text == "cpuset") return {pin_policy::cpuset, {}};
+    pinning pin;
+    if (cpu_topology::parse_cpu_list(text, pin.cpus) && !pin.cpus.empty()) pin.policy = pin_policy::list;
+    return pin;
+  }
+};
+
+// Orders the cpus of topo so that worker i runs on cpus[i % size].
+inline cpu_topology place(cpu_topology topo, const pinning& pin) {
+  if (pin.policy == pin_policy::none) return topo;
+  if (pin.policy == pin_policy::list) {
+    std::vector<cpu_topology::cpu> listed;
+    for (int id : pin.cpus)
+      for (const auto& c : topo.cpus)
+        if (c.id == id) listed.push_back(c);
+    // cpus outside the process cpuset are dropped, if none is left the
+    // workers are placed as for compact.
+    if (!listed.empty()) {
+      topo.cpus = std::move(listed);
+      return topo;
+    }
+  }
+  const auto ranks = topo.ranks();
+  std::vector<std::size_t> order(topo.cpus.size());
+  for (std::size_t i = 0; i < order.size(); ++i) order[i] = i;
+  std::sort(order.begin(), order.end(), [&](std::size_t a, std::size_t b) {
+    const auto& x = ranks[a];
+    const auto& y = ranks[b];
+    if (pin.policy != pin_policy::scatter) return x.compact < y.compact;
+    // The same rank in different sockets keeps compact order.
+    return std::tie(x.thread, x.core, x.llc, x.compact) < std::tie(y.thread, y.core, y.llc, y.compact);
+  });
+  std::vector<cpu_topology::cpu> placed;
+  for (std::size_t i : order) placed.push_back(topo.cpus[i]);
+  topo.cpus = std::move(placed);
+  return topo;
+}
+
+// True if the policy binds each worker to a cpu of its own, so that
+// cpu_topology::cpu_of says where it runs.
+inline bool pins_each_worker(pin_policy policy) {
+  return policy != pin_policy::none && policy != pin_policy::cpuset;
+}
+
+// Victims of one worker ordered by distance. Victims in
+// [end[l-1], end[l]) are at distance level l. Those from first_unknown
+// on run on a cpu nobody knows yet, they come last in the remote tier.
+template <typename worker_id_type>
+struct steal_tiers {
+  std::vector<worker_id_type> victims;
+  std::array<std::uint32_t, cpu_topology::num_levels> end{};
+  std::uint32_t first_unknown = 0;
+
+  // Re-sorts the victims of worker w. where(v) is the cpu worker v runs
+  // on, or nullptr if that is not known. Workers on the same cpu count
+  // as SMT siblings.
+  template <typename Where>
+  void sort(std::size_t w, std::size_t num_workers, Where&& where) {
+    constexpr std::size_t unknown = cpu_topology::num_levels;
+    const cpu_topology::cpu* own = where(w);
+    auto level_of = [&](std::size_t v) -> std::size_t {
+      const cpu_topology::cpu* c = where(v);
+      return own && c ? cpu_topology::distance(*own, *c) : unknown;
+    };
+    victims.clear();
+    for (std::size_t l = 0; l <= unknown; ++l) {
+      if (l == unknown) first_unknown = static_cast<std::uint32_t>(victims.size());
+      for (std::size_t v = 0; v < num_workers; ++v)
+        if (v != w && level_of(v) == l) victims.push_back(static_cast<worker_id_type>(v));
+      end[std::min(l, unknown - 1)] = static_cast<std::uint32_t>(victims.size());
+    }
+  }
+
+  // Workers below num_pinned run on cpu_of, the others are placed by
+  // the OS and start out unknown.
+  static std::vector<steal_tiers> build(const cpu_topology& topo, std::size_t num_workers,
+                                        std::size_t num_pinned) {
+    std::vector<steal_tiers> tiers(num_workers);
+    for (std::size_t w = 0; w < num_workers; ++w) {
+      tiers[w].sort(w, num_workers, [&](std::size_t v) -> const cpu_topology::cpu* {
+        return v < num_pinned ? &topo.cpu_of(v) : nullptr;
+      });
+    }
+    return tiers;
+  }
+};